@@ -0,0 +1,103 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Packed (4 bits per symbol) payload representation
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * A payload is almost entirely digits, plus '*' delimiters at fixed
+ * positions and the occasional letter (e.g. DD8822), so it fits in
+ * 4 bits per symbol with the delimiters left out entirely:
+ * 54 bytes of text become 23 bytes.
+ */
+
+#include <string.h>
+
+#include "bcd.h"
+
+/* 0-9 are themselves, and A-D are used as they are on DTMF keypads.
+ * 0xF is never produced, so that it can serve as padding.
+ * Stored off by one, so that anything not listed is invalid (0xFF after subtracting). */
+static const unsigned char encode[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['*'] = 0xA + 1, ['A'] = 0xB + 1, ['B'] = 0xC + 1, ['C'] = 0xD + 1, ['D'] = 0xE + 1,
+};
+
+static const char decode[16] = "0123456789*ABCD?";
+
+/* Positions that hold delimiters, in order */
+static const int delimiters[DATA_STARS] = DATA_DELIMITERS;
+
+int payload_pack(struct packed_payload *restrict p, const char *restrict payload)
+{
+	unsigned char sym[PACKED_SYMBOLS + 1];
+	unsigned char bad = 0;
+	int i, j, d = 0;
+
+	/* The trailing delimiter isn't strictly necessary (see data_done), so don't look at it */
+	for (i = j = 0; i < DATA_LENGTH - 1; i++) {
+		unsigned char c = (unsigned char) (encode[(unsigned char) payload[i]] - 1);
+		if (d < DATA_STARS && i == delimiters[d]) {
+			d++;
+			bad |= c ^ 0xA;
+		} else {
+			/* The phone number has to be all digits */
+			bad |= (c & 0xF0) | (j < NUMBER_LENGTH && c > 9);
+			sym[j++] = c;
+		}
+	}
+	if (bad) {
+		return -1;
+	}
+
+	sym[PACKED_SYMBOLS] = 0xF; /* Padding, if the symbol count is odd */
+	for (i = 0; i < PACKED_SIZE; i++) {
+		p->b[i] = (unsigned char) (sym[2 * i] << 4 | sym[2 * i + 1]);
+	}
+	return 0;
+}
+
+void payload_unpack(const struct packed_payload *restrict p, char *restrict buf)
+{
+	int i, j, d = 0;
+
+	for (i = j = 0; i < DATA_LENGTH; i++) {
+		if (d < DATA_STARS && i == delimiters[d]) {
+			d++;
+			buf[i] = '*';
+		} else {
+			unsigned char b = p->b[j / 2];
+			buf[i] = decode[j % 2 ? b & 0xF : b >> 4];
+			j++;
+		}
+	}
+	buf[DATA_LENGTH] = '\0';
+}
+
+int payload_cmp(const struct packed_payload *a, const struct packed_payload *b)
+{
+	return memcmp(a->b, b->b, PACKED_SIZE);
+}
+
+uint64_t payload_number(const struct packed_payload *p)
+{
+	uint64_t number = 0;
+	int i;
+
+	for (i = 0; i < NUMBER_LENGTH / 2; i++) {
+		number = number * 100 + (p->b[i] >> 4) * 10 + (p->b[i] & 0xF);
+	}
+	return number;
+}
@@ -0,0 +1,64 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Packed (4 bits per symbol) payload representation
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#ifndef _PROTEL_BCD_H
+#define _PROTEL_BCD_H
+
+#include <stdint.h>
+
+#include "protel.h"
+
+/*! \brief Number of non-delimiter symbols in a payload */
+#define PACKED_SYMBOLS (DATA_LENGTH - DATA_STARS)
+
+/*! \brief Size of a packed payload, in bytes */
+#define PACKED_SIZE ((PACKED_SYMBOLS + 1) / 2)
+
+/*!
+ * \brief A payload, packed 2 symbols per byte, high nibble first.
+ * The delimiters are implied by the payload format and not stored,
+ * and since the phone number comes first, the first 5 bytes are
+ * the phone number in BCD.
+ */
+struct packed_payload {
+	unsigned char b[PACKED_SIZE];
+};
+
+/*!
+ * \brief Pack a payload
+ * \param p
+ * \param payload Payload, starting at the first '*'. Must be at least DATA_LENGTH - 1 bytes.
+ * \retval 0 on success, -1 if the payload has misplaced delimiters or symbols that can't be represented
+ */
+int payload_pack(struct packed_payload *restrict p, const char *restrict payload);
+
+/*!
+ * \brief Unpack a payload
+ * \param p
+ * \param[out] buf Buffer of at least DATA_LENGTH + 1 bytes. Will be NUL terminated.
+ */
+void payload_unpack(const struct packed_payload *restrict p, char *restrict buf);
+
+/*! \brief Compare two packed payloads, like memcmp */
+int payload_cmp(const struct packed_payload *a, const struct packed_payload *b);
+
+/*! \brief Get the phone number in a packed payload, as an integer */
+uint64_t payload_number(const struct packed_payload *p);
+
+#endif /* _PROTEL_BCD_H */
@@ -0,0 +1,230 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief CRC32C (Castagnoli) checksums for saved captures
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * The checksum is stored in an extended attribute rather than in the file,
+ * so that the capture itself stays exactly what was received from the modem.
+ * Some network filesystems (e.g. NFSv3) don't support extended attributes,
+ * so there, it's stored in a small file next to the capture instead.
+ *
+ * On x86-64 CPUs with SSE 4.2, the CRC32 instruction is used,
+ * otherwise, a table-driven implementation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/xattr.h>
+
+#include "crc32c.h"
+
+#define POLY 0x82F63B78 /* Reversed Castagnoli polynomial */
+
+static uint32_t table[256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static void init_table(void)
+{
+	uint32_t i, j, crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++) {
+			crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+		}
+		table[i] = crc;
+	}
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	pthread_once(&table_once, init_table);
+	while (len--) {
+		crc = table[(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	uint64_t crc64 = crc;
+
+	/* Byte at a time until aligned, then 8 bytes at a time */
+	while (len && ((uintptr_t) buf & 7)) {
+		crc64 = __builtin_ia32_crc32qi((uint32_t) crc64, *buf++);
+		len--;
+	}
+	while (len >= 8) {
+		uint64_t word;
+		memcpy(&word, buf, sizeof(word));
+		crc64 = __builtin_ia32_crc32di(crc64, word);
+		buf += 8;
+		len -= 8;
+	}
+	while (len--) {
+		crc64 = __builtin_ia32_crc32qi((uint32_t) crc64, *buf++);
+	}
+	return (uint32_t) crc64;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	crc = ~crc;
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2")) {
+		return ~crc32c_hw(crc, buf, len);
+	}
+#endif
+	return ~crc32c_sw(crc, buf, len);
+}
+
+static void sidecar_name(char *buf, size_t len, const char *path)
+{
+	snprintf(buf, len, "%s%s", path, CRC32C_SUFFIX);
+}
+
+int crc32c_is_sidecar(const char *name)
+{
+	size_t len = strlen(name);
+	return len > strlen(CRC32C_SUFFIX) && !strcmp(name + len - strlen(CRC32C_SUFFIX), CRC32C_SUFFIX);
+}
+
+static int parse(const char *value, ssize_t len, uint32_t *crc)
+{
+	char *end;
+
+	*crc = (uint32_t) strtoul(value, &end, 16);
+	if (len != 8 || *end) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+int crc32c_set(int fd, const char *path, uint32_t crc)
+{
+	char value[9];
+	char sidecar[1024];
+	int sfd, res = 0;
+
+	snprintf(value, sizeof(value), "%08x", crc);
+	if (!fsetxattr(fd, CRC32C_XATTR, value, 8, 0)) {
+		return 0;
+	} else if (errno != ENOTSUP) {
+		return -1;
+	}
+
+	sidecar_name(sidecar, sizeof(sidecar), path);
+	sfd = open(sidecar, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (sfd < 0) {
+		return -1;
+	}
+	if (write(sfd, value, 8) != 8) {
+		res = -1;
+	}
+	if (close(sfd)) {
+		res = -1;
+	}
+	if (res) {
+		/* Better no checksum than a malformed one */
+		int err = errno;
+		unlink(sidecar);
+		errno = err;
+	}
+	return res;
+}
+
+int crc32c_get(int fd, const char *path, uint32_t *crc)
+{
+	char value[10];
+	char sidecar[1024];
+	ssize_t res;
+	int sfd, err;
+
+	res = fgetxattr(fd, CRC32C_XATTR, value, 8);
+	if (res >= 0) {
+		value[res] = '\0';
+		return parse(value, res, crc);
+	} else if (errno == ERANGE) {
+		errno = EINVAL; /* Too long to be a checksum */
+		return -1;
+	} else if (errno != ENODATA && errno != ENOTSUP) {
+		return -1;
+	}
+
+	err = errno;
+	sidecar_name(sidecar, sizeof(sidecar), path);
+	sfd = open(sidecar, O_RDONLY);
+	if (sfd < 0) {
+		if (errno == ENOENT) {
+			errno = err;
+		}
+		return -1;
+	}
+	/* Read one more than a checksum, so one that's too long can be told apart */
+	res = read(sfd, value, 9);
+	err = errno;
+	close(sfd);
+	if (res < 0) {
+		errno = err;
+		return -1;
+	}
+	value[res] = '\0';
+	return parse(value, res, crc);
+}
+
+int crc32c_rename(const char *oldpath, const char *newpath)
+{
+	char oldsidecar[1024], newsidecar[1024];
+	int err;
+
+	/* Move the checksum first, so the file is never without it */
+	sidecar_name(oldsidecar, sizeof(oldsidecar), oldpath);
+	sidecar_name(newsidecar, sizeof(newsidecar), newpath);
+	if (rename(oldsidecar, newsidecar)) {
+		if (errno != ENOENT) {
+			return -1;
+		}
+		return rename(oldpath, newpath);
+	}
+	if (rename(oldpath, newpath)) {
+		err = errno;
+		rename(newsidecar, oldsidecar);
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+int crc32c_unlink(const char *path)
+{
+	char sidecar[1024];
+
+	sidecar_name(sidecar, sizeof(sidecar), path);
+	if (unlink(path)) {
+		return -1;
+	}
+	unlink(sidecar);
+	return 0;
+}
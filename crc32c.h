@@ -0,0 +1,79 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief CRC32C (Castagnoli) checksums for saved captures
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#ifndef _PROTEL_CRC32C_H
+#define _PROTEL_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*! \brief Extended attribute in which a capture's checksum is stored, as 8 hex digits */
+#define CRC32C_XATTR "user.crc32c"
+
+/*!
+ * \brief Suffix of the file a capture's checksum is stored in instead,
+ * if the filesystem doesn't support extended attributes (e.g. NFSv3)
+ */
+#define CRC32C_SUFFIX ".crc32c"
+
+/*!
+ * \brief Compute or continue a CRC32C
+ * \param crc 0 to start, or the result of a previous call to continue
+ * \param buf
+ * \param len
+ * \return Checksum
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/*!
+ * \brief Store a checksum on an open file,
+ * in a CRC32C_SUFFIX file next to it if the filesystem can't store it as an attribute
+ * \param fd
+ * \param path Name of the file
+ * \param crc
+ * \retval 0 on success, -1 on failure (errno is set)
+ */
+int crc32c_set(int fd, const char *path, uint32_t crc);
+
+/*!
+ * \brief Retrieve a checksum stored on an open file, or in a CRC32C_SUFFIX file next to it
+ * \param fd
+ * \param path Name of the file
+ * \param[out] crc
+ * \retval 0 on success, -1 if there isn't one or on failure (errno is set).
+ *         errno is ENODATA (or ENOTSUP) if there is no checksum, and EINVAL if it is malformed.
+ */
+int crc32c_get(int fd, const char *path, uint32_t *crc);
+
+/*! \brief Whether a file name is that of a checksum, rather than a capture */
+int crc32c_is_sidecar(const char *name);
+
+/*!
+ * \brief rename() a file, along with its checksum file if it has one
+ * \retval 0 on success, -1 on failure (errno is set)
+ */
+int crc32c_rename(const char *oldpath, const char *newpath);
+
+/*!
+ * \brief unlink() a file, along with its checksum file if it has one
+ * \retval 0 on success, -1 on failure (errno is set)
+ */
+int crc32c_unlink(const char *path);
+
+#endif /* _PROTEL_CRC32C_H */
@@ -0,0 +1,181 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief In-memory table of the latest payload for each phone number
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Entries are keyed by the phone number, which is the first 5 bytes
+ * of the packed payload, so each entry is only a few dozen bytes.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+
+static inline size_t bucket(const struct history *h, uint64_t number)
+{
+	/* Phone numbers aren't uniformly distributed, so mix them up a bit */
+	number *= 0x9E3779B97F4A7C15ULL;
+	return (size_t) (number >> 32) % h->nbuckets;
+}
+
+int history_init(struct history *h, size_t nbuckets)
+{
+	memset(h, 0, sizeof(*h));
+	h->nbuckets = nbuckets ? nbuckets : 1;
+	h->buckets = calloc(h->nbuckets, sizeof(*h->buckets));
+	if (!h->buckets) {
+		return -1;
+	}
+	pthread_mutex_init(&h->lock, NULL);
+	return 0;
+}
+
+void history_destroy(struct history *h)
+{
+	size_t i;
+
+	for (i = 0; i < h->nbuckets; i++) {
+		struct history_entry *e = h->buckets[i];
+		while (e) {
+			struct history_entry *next = e->next;
+			free(e);
+			e = next;
+		}
+	}
+	free(h->buckets);
+	h->buckets = NULL;
+	h->nbuckets = h->count = 0;
+	pthread_mutex_destroy(&h->lock);
+}
+
+/*! \note Must be called with the lock held */
+static void grow(struct history *h)
+{
+	struct history_entry **newbuckets;
+	struct history_entry **oldbuckets = h->buckets;
+	size_t oldcount = h->nbuckets;
+	size_t i;
+
+	newbuckets = calloc(2 * oldcount, sizeof(*newbuckets));
+	if (!newbuckets) {
+		return; /* Keep using the old buckets, it'll just be slower */
+	}
+	h->buckets = newbuckets;
+	h->nbuckets = 2 * oldcount;
+	for (i = 0; i < oldcount; i++) {
+		struct history_entry *e = oldbuckets[i];
+		while (e) {
+			struct history_entry *next = e->next;
+			size_t b = bucket(h, payload_number(&e->payload));
+			e->next = h->buckets[b];
+			h->buckets[b] = e;
+			e = next;
+		}
+	}
+	free(oldbuckets);
+}
+
+int history_update(struct history *h, const struct packed_payload *p, time_t when, time_t *updated)
+{
+	struct history_entry *e;
+	uint64_t number = payload_number(p);
+	int res = 1;
+
+	pthread_mutex_lock(&h->lock);
+	if (!when) {
+		when = time(NULL);
+	}
+	for (e = h->buckets[bucket(h, number)]; e; e = e->next) {
+		/* The number is the leading BCD bytes, so compare those directly */
+		if (!memcmp(e->payload.b, p->b, NUMBER_LENGTH / 2)) {
+			break;
+		}
+	}
+	if (!e) {
+		size_t b;
+		e = calloc(1, sizeof(*e));
+		if (!e) {
+			pthread_mutex_unlock(&h->lock);
+			return -1;
+		}
+		if (++h->count > h->nbuckets) {
+			grow(h);
+		}
+		b = bucket(h, number);
+		e->next = h->buckets[b];
+		h->buckets[b] = e;
+	} else if (!payload_cmp(&e->payload, p)) {
+		res = 0;
+	}
+
+	if (updated) {
+		*updated = e->updated;
+	}
+	if (res) {
+		e->payload = *p;
+		e->updated = when;
+	}
+	if (res && h->hook) {
+		h->hook(e, h->hook_data);
+	}
+	pthread_mutex_unlock(&h->lock);
+	return res;
+}
+
+size_t history_count(struct history *h)
+{
+	size_t count;
+
+	pthread_mutex_lock(&h->lock);
+	count = h->count;
+	pthread_mutex_unlock(&h->lock);
+	return count;
+}
+
+void history_set_hook(struct history *h, history_hook hook, void *data)
+{
+	pthread_mutex_lock(&h->lock);
+	h->hook = hook;
+	h->hook_data = data;
+	pthread_mutex_unlock(&h->lock);
+}
+
+struct history_entry *history_snapshot(struct history *h, size_t *count, history_hook locked, void *data)
+{
+	struct history_entry *entries, *e;
+	size_t i, n = 0;
+
+	pthread_mutex_lock(&h->lock);
+	entries = malloc((h->count + 1) * sizeof(*entries)); /* Even if empty */
+	if (!entries) {
+		pthread_mutex_unlock(&h->lock);
+		return NULL;
+	}
+	for (i = 0; i < h->nbuckets; i++) {
+		for (e = h->buckets[i]; e; e = e->next) {
+			entries[n] = *e;
+			entries[n++].next = NULL;
+		}
+	}
+	if (locked) {
+		locked(NULL, data);
+	}
+	pthread_mutex_unlock(&h->lock);
+
+	*count = n;
+	return entries;
+}
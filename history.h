@@ -0,0 +1,88 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief In-memory table of the latest payload for each phone number
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#ifndef _PROTEL_HISTORY_H
+#define _PROTEL_HISTORY_H
+
+#include <pthread.h>
+#include <time.h>
+
+#include "bcd.h"
+
+struct history_entry {
+	struct history_entry *next;
+	time_t updated;			/*!< When the payload last changed */
+	struct packed_payload payload;
+};
+
+/*! \brief Callback for changes to a history table. Called with the table locked. */
+typedef void (*history_hook)(const struct history_entry *e, void *data);
+
+struct history {
+	pthread_mutex_t lock;
+	struct history_entry **buckets;
+	size_t nbuckets;
+	size_t count;
+	history_hook hook;
+	void *hook_data;
+};
+
+/*!
+ * \brief Initialize a history table
+ * \param h
+ * \param nbuckets Initial number of buckets. The table grows as needed.
+ * \retval 0 on success, -1 on failure
+ */
+int history_init(struct history *h, size_t nbuckets);
+
+/*! \brief Free all the entries in a history table */
+void history_destroy(struct history *h);
+
+/*!
+ * \brief Record the payload from a successful call
+ * \param h
+ * \param p Packed payload
+ * \param when Time of the call, or 0 for now. Now is read with the table locked,
+ *        so that changes are timestamped in the order they're made.
+ * \param[out] updated If non-NULL, when the previous payload for this number was first seen, or 0 if it's new
+ * \retval 1 if the payload is new or has changed, 0 if it's unchanged, -1 on failure
+ */
+int history_update(struct history *h, const struct packed_payload *p, time_t when, time_t *updated);
+
+/*! \brief Number of phone numbers in a history table */
+size_t history_count(struct history *h);
+
+/*!
+ * \brief Get notified whenever a payload is new or has changed.
+ * Since the table is locked, changes are seen in the order they're made.
+ */
+void history_set_hook(struct history *h, history_hook hook, void *data);
+
+/*!
+ * \brief Copy all the entries in a history table
+ * \param h
+ * \param[out] count Number of entries
+ * \param locked If non-NULL, called (with NULL for the entry) before the table is unlocked,
+ *        so nothing can change between taking the snapshot and this call.
+ * \param data
+ * \return Array of entries, which must be freed, or NULL on failure
+ */
+struct history_entry *history_snapshot(struct history *h, size_t *count, history_hook locked, void *data);
+
+#endif /* _PROTEL_HISTORY_H */
@@ -0,0 +1,495 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Checkpoints and change logs of the latest payload for each number
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Every time a number's payload changes, a fixed-size record is appended
+ * to the current change log. Every so often, the whole table is written
+ * out as a checkpoint, state.<time>.ckpt, and a new log, changes.<time>.log,
+ * is started at the same moment, so the log has exactly the changes made
+ * since the checkpoint.
+ *
+ * The state as of any time can then be rebuilt by loading the latest
+ * checkpoint at or before then and replaying the logs after it,
+ * rather than rescanning every capture.
+ *
+ * If a checkpoint is missing or damaged, an older one is used,
+ * and the logs since then are replayed instead. Each log record has its
+ * own checksum, and a damaged record is skipped without losing the ones after it.
+ */
+
+#define _GNU_SOURCE /* for O_DIRECTORY */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+#include "crc32c.h"
+
+static char journal_dir[512] = "";
+
+/* The log is only written with the history table locked */
+static int log_fd = -1;
+static time_t log_start = 0;
+static int log_warned = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static long changes = 0; /* Changes since the last checkpoint */
+static int due = 0;
+
+static uint32_t record_crc(const struct journal_record *record)
+{
+	return crc32c(crc32c(0, &record->when, sizeof(record->when)), &record->payload, sizeof(record->payload));
+}
+
+static int time_cmp(const void *a, const void *b)
+{
+	time_t x = *(const time_t *) a, y = *(const time_t *) b;
+	return x < y ? -1 : x > y;
+}
+
+/*!
+ * \brief Get the times of all the checkpoints or logs in a directory
+ * \param dir
+ * \param prefix
+ * \param suffix
+ * \param[out] times Sorted times, oldest first, which must be freed
+ * \retval Number of files, or -1 on failure
+ */
+static int list_files(const char *dir, const char *prefix, const char *suffix, time_t **times)
+{
+	struct dirent **entries;
+	size_t plen = strlen(prefix);
+	int i, n, count = 0;
+
+	n = scandir(dir, &entries, NULL, NULL);
+	if (n < 0) {
+		fprintf(stderr, "scandir(%s) failed: %s\n", dir, strerror(errno));
+		return -1;
+	}
+
+	*times = malloc((n + 1) * sizeof(**times));
+	for (i = 0; i < n; i++) {
+		const char *name = entries[i]->d_name;
+		char *end;
+		long when;
+		if (*times && !strncmp(name, prefix, plen)) {
+			when = strtol(name + plen, &end, 10);
+			if (end != name + plen && !strcmp(end, suffix)) {
+				(*times)[count++] = when;
+			}
+		}
+		free(entries[i]);
+	}
+	free(entries);
+
+	if (!*times) {
+		fprintf(stderr, "malloc failed\n");
+		return -1;
+	}
+	qsort(*times, count, sizeof(**times), time_cmp);
+	return count;
+}
+
+static int load_checkpoint(const char *dir, time_t when, struct history *h)
+{
+	char filename[1024];
+	struct journal_header hdr;
+	struct journal_record records[256];
+	uint64_t left;
+	uint32_t crc = 0;
+	FILE *fp;
+	size_t i, n;
+
+	snprintf(filename, sizeof(filename), "%s/state.%ld.ckpt", dir, (long) when);
+	fp = fopen(filename, "rb");
+	if (!fp) {
+		fprintf(stderr, "fopen(%s) failed: %s\n", filename, strerror(errno));
+		return -1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != JOURNAL_MAGIC || hdr.version != JOURNAL_VERSION) {
+		fprintf(stderr, "%s is not a checkpoint (or is from a different version)\n", filename);
+		fclose(fp);
+		return -1;
+	}
+
+	for (left = hdr.count; left; left -= n) {
+		n = fread(records, sizeof(records[0]), left < 256 ? left : 256, fp);
+		if (!n) {
+			fprintf(stderr, "%s is truncated\n", filename);
+			fclose(fp);
+			return -1;
+		}
+		crc = crc32c(crc, records, n * sizeof(records[0]));
+		for (i = 0; i < n; i++) {
+			if (history_update(h, &records[i].payload, records[i].when, NULL) < 0) {
+				fclose(fp);
+				return -1;
+			}
+		}
+	}
+	fclose(fp);
+
+	if (crc != hdr.crc) {
+		fprintf(stderr, "%s is corrupted (%08x != %08x)\n", filename, crc, hdr.crc);
+		return -1;
+	}
+	return 0;
+}
+
+/*!
+ * \brief Replay a change log
+ * \param dir
+ * \param start Time the log starts at
+ * \param h
+ * \param until Skip changes after this time
+ * \retval Number of changes replayed, or -1 on failure
+ */
+static long replay_log(const char *dir, time_t start, struct history *h, time_t until)
+{
+	char filename[1024];
+	struct journal_record record;
+	long replayed = 0, damaged = 0;
+	FILE *fp;
+
+	snprintf(filename, sizeof(filename), "%s/changes.%ld.log", dir, (long) start);
+	fp = fopen(filename, "rb");
+	if (!fp) {
+		fprintf(stderr, "fopen(%s) failed: %s\n", filename, strerror(errno));
+		return -1;
+	}
+	/* A partial record at the end (if we crashed while writing it) is ignored.
+	 * Records are fixed-size, so a damaged one doesn't affect the ones after it. */
+	while (fread(&record, sizeof(record), 1, fp) == 1) {
+		if (record.crc != record_crc(&record)) {
+			damaged++;
+			continue;
+		}
+		/* Don't stop at the first later one, in case the clock went backwards */
+		if (record.when > until) {
+			continue;
+		}
+		if (history_update(h, &record.payload, record.when, NULL) < 0) {
+			fclose(fp);
+			return -1;
+		}
+		replayed++;
+	}
+	fclose(fp);
+
+	if (damaged) {
+		fprintf(stderr, "Skipped %ld damaged record%s in %s\n", damaged, damaged == 1 ? "" : "s", filename);
+	}
+	return replayed;
+}
+
+/*!
+ * \brief Rebuild a history table
+ * \param dir
+ * \param h
+ * \param until
+ * \param[out] checkpoint Time of the checkpoint used, or 0 if none was
+ * \param[out] last Time of the latest log replayed, or 0 if none was
+ * \retval Number of changes replayed, or -1 on failure
+ */
+static long load(const char *dir, struct history *h, time_t until, time_t *checkpoint, time_t *last)
+{
+	time_t *ckpts, *logs;
+	int i, nckpts, nlogs;
+	long res, replayed = 0;
+
+	nckpts = list_files(dir, "state.", ".ckpt", &ckpts);
+	if (nckpts < 0) {
+		return -1;
+	}
+	nlogs = list_files(dir, "changes.", ".log", &logs);
+	if (nlogs < 0) {
+		free(ckpts);
+		return -1;
+	}
+
+	*checkpoint = *last = 0;
+	for (i = nckpts - 1; i >= 0; i--) {
+		if (ckpts[i] > until) {
+			continue;
+		}
+		if (!load_checkpoint(dir, ckpts[i], h)) {
+			*checkpoint = ckpts[i];
+			break;
+		}
+		/* Start over from an older checkpoint, and replay more of the log */
+		fprintf(stderr, "Unable to use checkpoint from %ld, trying an older one\n", (long) ckpts[i]);
+		history_destroy(h);
+		if (history_init(h, 1024)) {
+			replayed = -1;
+			goto cleanup;
+		}
+	}
+
+	/* Each log starts at a checkpoint and ends at the next one.
+	 * If the clock went backwards, the first log starting after until
+	 * can still have earlier changes, so replay that one too.
+	 * Changes after until are skipped record by record. */
+	for (i = 0; i < nlogs && (i == 0 || logs[i - 1] <= until); i++) {
+		if (logs[i] < *checkpoint) {
+			continue;
+		}
+		res = replay_log(dir, logs[i], h, until);
+		if (res < 0) {
+			replayed = -1;
+			goto cleanup;
+		}
+		replayed += res;
+		*last = logs[i];
+	}
+
+cleanup:
+	free(ckpts);
+	free(logs);
+	return replayed;
+}
+
+long journal_load(const char *dir, struct history *h, time_t until, time_t *checkpoint)
+{
+	time_t when = 0, last;
+	long res;
+
+	res = load(dir, h, until, &when, &last);
+	if (checkpoint) {
+		*checkpoint = when;
+	}
+	return res;
+}
+
+static int open_log(time_t start)
+{
+	char filename[1024];
+	struct stat st;
+	int fd;
+
+	snprintf(filename, sizeof(filename), "%s/changes.%ld.log", journal_dir, (long) start);
+	fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "open(%s) failed: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	/* Drop a partial record left by a crash, so that the ones we append line up */
+	if (!fstat(fd, &st) && st.st_size % sizeof(struct journal_record)) {
+		fprintf(stderr, "Truncating partial record at end of %s\n", filename);
+		if (ftruncate(fd, st.st_size - st.st_size % (off_t) sizeof(struct journal_record))) {
+			fprintf(stderr, "ftruncate(%s) failed: %s\n", filename, strerror(errno));
+			close(fd);
+			return -1;
+		}
+	}
+	return fd;
+}
+
+/*! \note Called with the history table locked */
+static void log_change(const struct history_entry *e, void *data)
+{
+	const struct history *h = data;
+	struct journal_record record;
+
+	memset(&record, 0, sizeof(record));
+	record.when = e->updated;
+	record.payload = e->payload;
+	record.crc = record_crc(&record);
+	if (write(log_fd, &record, sizeof(record)) != sizeof(record) && !log_warned) {
+		/* Not fatal, but the state can't be rebuilt until the next checkpoint */
+		fprintf(stderr, "Failed to write to change log: %s\n", strerror(errno));
+		log_warned = 1;
+	}
+
+	pthread_mutex_lock(&lock);
+	changes++;
+	if (changes >= JOURNAL_CHECKPOINT_CHANGES && (size_t) changes >= h->count / JOURNAL_CHECKPOINT_RATIO) {
+		due = 1;
+		pthread_cond_signal(&cond);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/*! \note Called with the history table locked, right after it's been copied */
+static void rotate_log(const struct history_entry *e, void *data)
+{
+	time_t *when = data;
+	time_t now = time(NULL);
+	int fd;
+
+	(void) e;
+
+	*when = 0;
+	if (now <= log_start) {
+		return; /* Files are named by the second, wait for the next one */
+	}
+	fd = open_log(now);
+	if (fd < 0) {
+		return;
+	}
+	close(log_fd);
+	log_fd = fd;
+	log_start = now;
+	log_warned = 0;
+	*when = now;
+
+	pthread_mutex_lock(&lock);
+	changes = 0;
+	due = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+static int checkpoint(struct history *h)
+{
+	char tmpname[1024], filename[1024];
+	struct journal_header hdr;
+	struct journal_record record;
+	struct history_entry *entries;
+	size_t i, count;
+	time_t when;
+	FILE *fp;
+	int fd;
+
+	entries = history_snapshot(h, &count, rotate_log, &when);
+	if (!entries) {
+		fprintf(stderr, "Failed to copy history for checkpoint\n");
+		return -1;
+	} else if (!when) {
+		free(entries);
+		return -1;
+	}
+
+	snprintf(tmpname, sizeof(tmpname), "%s/.state.%ld.ckpt.tmp", journal_dir, (long) when);
+	snprintf(filename, sizeof(filename), "%s/state.%ld.ckpt", journal_dir, (long) when);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = JOURNAL_MAGIC;
+	hdr.version = JOURNAL_VERSION;
+	hdr.when = when;
+	hdr.count = count;
+
+	fp = fopen(tmpname, "wb");
+	if (!fp) {
+		fprintf(stderr, "fopen(%s) failed: %s\n", tmpname, strerror(errno));
+		free(entries);
+		return -1;
+	}
+	/* Leave room for the header, which has the checksum of everything after it */
+	fseek(fp, sizeof(hdr), SEEK_SET);
+	memset(&record, 0, sizeof(record));
+	for (i = 0; i < count; i++) {
+		record.when = entries[i].updated;
+		record.payload = entries[i].payload;
+		record.crc = record_crc(&record);
+		hdr.crc = crc32c(hdr.crc, &record, sizeof(record));
+		fwrite(&record, sizeof(record), 1, fp);
+	}
+	free(entries);
+	rewind(fp);
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+
+	/* The logs before this are only useful if the checkpoint made it to disk */
+	if (fflush(fp) || ferror(fp) || fsync(fileno(fp))) {
+		fprintf(stderr, "Failed to write %s: %s\n", tmpname, strerror(errno));
+		fclose(fp);
+		unlink(tmpname);
+		return -1;
+	}
+	fclose(fp);
+	if (rename(tmpname, filename)) {
+		fprintf(stderr, "rename(%s, %s) failed: %s\n", tmpname, filename, strerror(errno));
+		unlink(tmpname);
+		return -1;
+	}
+	fd = open(journal_dir, O_RDONLY | O_DIRECTORY);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+
+	fprintf(stderr, "Checkpointed %lu numbers to %s\n", count, filename);
+	return 0;
+}
+
+static void *checkpointer(void *varg)
+{
+	struct history *h = varg;
+
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		while (!due) {
+			pthread_cond_wait(&cond, &lock);
+		}
+		pthread_mutex_unlock(&lock);
+
+		if (checkpoint(h)) {
+			sleep(1); /* Try again shortly */
+		}
+	}
+	return NULL;
+}
+
+int journal_start(const char *dir, struct history *h)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	time_t ckpt, last;
+	long replayed;
+	int res;
+
+	strncpy(journal_dir, dir, sizeof(journal_dir) - 1);
+	journal_dir[sizeof(journal_dir) - 1] = '\0';
+
+	replayed = load(journal_dir, h, LONG_MAX, &ckpt, &last);
+	if (replayed < 0) {
+		return -1;
+	}
+	if (ckpt || last) {
+		fprintf(stderr, "Restored %lu numbers from checkpoint %ld and %ld changes\n", history_count(h), (long) ckpt, replayed);
+	}
+
+	/* Pick up where the last log left off, so a restart doesn't need a checkpoint */
+	log_start = last > ckpt ? last : ckpt;
+	if (!log_start) {
+		log_start = time(NULL);
+	}
+	log_fd = open_log(log_start);
+	if (log_fd < 0) {
+		return -1;
+	}
+	changes = replayed;
+	history_set_hook(h, log_change, h);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	res = pthread_create(&thread, &attr, checkpointer, h);
+	pthread_attr_destroy(&attr);
+	if (res) {
+		fprintf(stderr, "pthread_create failed: %s\n", strerror(res));
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Checkpoints and change logs of the latest payload for each number
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#ifndef _PROTEL_JOURNAL_H
+#define _PROTEL_JOURNAL_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "bcd.h"
+#include "history.h"
+
+/*!
+ * \brief Checkpoint after this many changes, or 1/JOURNAL_CHECKPOINT_RATIO
+ * as many changes as there are numbers, whichever is more.
+ * This bounds how much of the log has to be replayed, without
+ * checkpoints (which are the whole table) taking up much more space.
+ */
+#define JOURNAL_CHECKPOINT_CHANGES 10000
+#define JOURNAL_CHECKPOINT_RATIO 4
+
+#define JOURNAL_MAGIC 0x5052434B /* "PRCK" */
+#define JOURNAL_VERSION 2
+
+/*! \brief A payload, and when it was first seen. Both files are made of these. */
+struct journal_record {
+	int64_t when;
+	uint32_t crc;			/*!< CRC32C of when and payload, so each record can be checked on its own */
+	struct packed_payload payload;
+	unsigned char unused[5];
+};
+
+/*! \brief Header at the start of a checkpoint file, followed by the records */
+struct journal_header {
+	uint32_t magic;
+	uint32_t version;
+	int64_t when;			/*!< Includes every change made up to this time */
+	uint64_t count;			/*!< Number of records */
+	uint32_t crc;			/*!< CRC32C of the records */
+	uint32_t unused;
+};
+
+/*!
+ * \brief Rebuild a history table as it was at a point in time,
+ * from the latest usable checkpoint at or before then and the change logs after it.
+ * \param dir Journal directory
+ * \param h Empty history table
+ * \param until Time to rebuild the table as of
+ * \param[out] checkpoint If non-NULL, time of the checkpoint used, or 0 if none was
+ * \retval Number of changes replayed from the logs, or -1 on failure
+ */
+long journal_load(const char *dir, struct history *h, time_t until, time_t *checkpoint);
+
+/*!
+ * \brief Restore a history table from a journal directory, then keep journaling changes to it.
+ * \param dir Journal directory
+ * \param h Empty history table
+ * \retval 0 on success, -1 on failure
+ */
+int journal_start(const char *dir, struct history *h);
+
+#endif /* _PROTEL_JOURNAL_H */
@@ -0,0 +1,35 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Protel payload format, shared by proteld and the offline tools
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#ifndef _PROTEL_H
+#define _PROTEL_H
+
+/* A payload looks like this, starting at the first '*':
+ * *3115552368*43125*DD8822*1234*032*2312237122028*37090*
+ */
+#define DATA_LENGTH 54
+#define DATA_STARS 8
+
+/*! \brief Offsets of the '*' delimiters, relative to the first one */
+#define DATA_DELIMITERS { 0, 11, 17, 24, 29, 33, 47, 53 }
+
+/*! \brief Length of the phone number, which immediately follows the first '*' */
+#define NUMBER_LENGTH 10
+
+#endif /* _PROTEL_H */
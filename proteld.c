@@ -68,18 +68,34 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <assert.h>
+#include <time.h>
+
+#include "protel.h"
+#include "history.h"
+#include "journal.h"
+#include "spool.h"
+#include "crc32c.h"
+#include "tuning.h"
+#include "stats.h"
 
 static int listen_port = -1;
 static int listen_local = 0;
 static int debug_level = 0;
 static char outputdir[512] = "";
+static char spooldir[512] = "";
+static char journaldir[512] = "";
+static int checksum_warned = 0;
 static int log_to_file = 0;
 
 static int calls_success = 0;
 static int calls_total = 0;
 
-#define DATA_LENGTH 54
-#define DATA_STARS 8
+/* Latest payload for each number we've called */
+static struct history history;
+
+static struct fleet_stats stats;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static char statsfile[512] = "";
 
 #define is_d(x) (x == 'D')
 #define TRUE(x) (1)
@@ -158,54 +174,147 @@ static inline int data_done(char *restrict buf, int len)
 	return 1;
 }
 
+static int write_capture(const char *filename, const unsigned char *restrict buf, int len)
+{
+	int fd;
+	ssize_t wres;
+
+	/* We're writing everything at once,
+	 * so there's not much point in using a buffered write. */
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "open(%s) failed: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	wres = write(fd, buf, len);
+	if (wres != len) {
+		fprintf(stderr, "Wanted to write %d bytes to %s, only wrote %lu: %s\n", len, filename, wres, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	/* Checksum what we meant to write, so corruption on disk can be detected later */
+	if (crc32c_set(fd, filename, crc32c(0, buf, len)) && !checksum_warned) {
+		/* Not fatal, but probably going to happen every time, so only say so once */
+		fprintf(stderr, "Unable to store checksum for %s: %s\n", filename, strerror(errno));
+		checksum_warned = 1;
+	}
+
+	close(fd);
+	return 0;
+}
+
 static int save_data(const unsigned char *restrict buf, int len, int success)
 {
+	char name[64];
 	char filename[684];
 	char *tmp;
-	int fd;
-	ssize_t wres;
 
 	if (success) {
 		/* Determine the phone number */
 		tmp = memchr(buf, '*', len);
 		assert(tmp != NULL);
 		tmp++;
-		snprintf(filename, sizeof(filename), "%s/%lu_%.*s.txt", outputdir, time(NULL), 10, tmp);
+		snprintf(name, sizeof(name), "%lu_%.*s.txt", time(NULL), 10, tmp);
 	} else {
 		/* If we couldn't successfully infer the phone number,
 		 * use the current timestamp to make a unique name.
 		 * There's a small chance this filename might already exist,
 		 * if this daemon is being used by multiple modems concurrently,
 		 * so also add a random number for good measure.
+		 * If spooling, only check the spool, to stay off the slow storage.
 		 */
 		do {
-			snprintf(filename, sizeof(filename), "%s/%lu_%d_R.txt", outputdir, time(NULL), rand() % 100000);
+			snprintf(name, sizeof(name), "%lu_%d_R.txt", time(NULL), rand() % 100000);
+			snprintf(filename, sizeof(filename), "%s/%s", *spooldir ? spooldir : outputdir, name);
 		} while (!access(filename, R_OK));
 	}
 
-	/* We're writing everything at once,
-	 * so there's not much point in using a buffered write. */
-	fd = open(filename, O_WRONLY | O_CREAT);
-	if (fd < 0) {
-		fprintf(stderr, "open(%s) failed: %s\n", filename, strerror(errno));
-		return -1;
+	if (*spooldir) {
+		if (!spool_reserve()) {
+			snprintf(filename, sizeof(filename), "%s/%s.tmp", spooldir, name);
+			if (!write_capture(filename, buf, len) && !spool_commit(filename)) {
+				return 0;
+			}
+			crc32c_unlink(filename);
+			spool_release();
+		}
+		/* Spool is full or unusable, fall back to writing it out ourselves */
+		fprintf(stderr, "Unable to spool %s, saving directly\n", name);
 	}
 
-	wres = write(fd, buf, len);
-	if (wres != len) {
-		fprintf(stderr, "Wanted to write %d bytes to %s, only wrote %lu: %s\n", len, filename, wres, strerror(errno));
-		close(fd);
-		return -1;
+	snprintf(filename, sizeof(filename), "%s/%s", outputdir, name);
+	return write_capture(filename, buf, len);
+}
+
+static void record_payload(const unsigned char *restrict buf, int len)
+{
+	struct packed_payload packed;
+	char *start;
+	time_t updated;
+	int res;
+
+	start = memchr(buf, '*', len);
+	assert(start != NULL);
+
+	if (payload_pack(&packed, start)) {
+		/* Corrupted in a way autocorrect couldn't fix, don't remember it */
+		fprintf(stderr, "Payload contains unexpected characters, not adding to history\n");
+		return;
 	}
 
-	close(fd);
-	return 0;
+	res = history_update(&history, &packed, 0, &updated);
+	if (res < 0) {
+		fprintf(stderr, "Failed to update history for %.*s\n", NUMBER_LENGTH, start + 1);
+	} else if (!res) {
+		fprintf(stderr, "Payload for %.*s unchanged since %lu\n", NUMBER_LENGTH, start + 1, updated);
+	} else if (updated) {
+		fprintf(stderr, "Payload for %.*s has changed since %lu\n", NUMBER_LENGTH, start + 1, updated);
+	}
+}
+
+static void account_call(const unsigned char *restrict buf, int len, int success, struct in_addr peer)
+{
+	const char *start = memchr(buf, '*', len);
+	uint64_t number = 0;
+	int i;
+
+	/* Even if the call failed, we may have gotten the number */
+	if (start && start + 1 + NUMBER_LENGTH <= (const char *) buf + len) {
+		for (i = 1; i <= NUMBER_LENGTH && isdigit(start[i]); i++) {
+			number = number * 10 + (uint64_t) (start[i] - '0');
+		}
+		if (i <= NUMBER_LENGTH) {
+			number = 0;
+		}
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	stats_call(&stats, time(NULL), peer.s_addr, number, success ? start : NULL);
+	pthread_mutex_unlock(&stats_lock);
+}
+
+struct conn {
+	int fd;
+	struct sockaddr_in addr;
+};
+
+static int elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int) ((now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000);
 }
 
 static void *handler(void *varg)
 {
-	int *fdptr = varg;
-	int fd = *fdptr;
+	struct conn *conn = varg;
+	int fd = conn->fd;
+	struct in_addr peer = conn->addr.sin_addr;
+	struct call_params params;
+	struct timespec start;
 	unsigned char buf[512];
 	char *pos = (char*) buf;
 	int bytes_read = 0;
@@ -214,13 +323,33 @@ static void *handler(void *varg)
 	int success = 0;
 	int reset = 0;
 
+	free(conn);
+
 	fprintf(stderr, "Call # %d: New connection on fd %d\n", ++calls_total, fd);
 
+	tuning_get(peer, &params);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	for (;;) {
+		int res;
+
+		if (params.deadline) {
+			/* Don't keep paying for a call that's gone on longer than it should */
+			struct pollfd pfd = { .fd = fd, .events = POLLIN };
+			int remaining = params.deadline * 1000 - elapsed_ms(&start);
+			res = remaining > 0 ? poll(&pfd, 1, remaining) : 0;
+			if (!res) {
+				fprintf(stderr, "\nNo payload after %d s, aborting\n", params.deadline);
+				break;
+			} else if (res < 0 && errno == EINTR) {
+				continue;
+			}
+		}
+
 		/* Given it's a 300 baud modem,
 		 * we're probably going to be reading
 		 * from the socket byte by byte */
-		int res = read(fd, pos, left - 1);
+		res = read(fd, pos, left - 1);
 		if (res <= 0) {
 			fprintf(stderr, "\nread(%d) returned %d: %s\n", fd, res, strerror(errno));
 			break;
@@ -268,9 +397,10 @@ static void *handler(void *varg)
 		} else if (bytes_read > DATA_LENGTH && (memmem(buf + 30, bytes_read - 30, "\x01\x00\x00", 3) || memmem(buf + 30, bytes_read - 30, "\x00\x00\x00", 3))) {
 			/* Payload was probably corrupted.
 			 * Reset and see if it comes through the second time. */
-			if (++reset == 2) {
-				fprintf(stderr, "\nDuplicate corruption, aborting\n");
+			if (++reset >= params.max_corrupt) {
+				fprintf(stderr, "\n%s corruption, aborting\n", reset > 1 ? "Duplicate" : "Data");
 				/* We already got 2 printouts, there won't be any more,
+				 * (or, for this peer, the second one is rarely any better),
 				 * so disconnect immediately. */
 				break;
 			}
@@ -288,6 +418,13 @@ static void *handler(void *varg)
 	 * and end the phone call. */
 	close(fd);
 
+	tuning_report(peer, &params, success, elapsed_ms(&start) / 1000.0, reset);
+
+	if (success) {
+		record_payload(buf, bytes_read);
+	}
+	account_call(buf, bytes_read, success, peer);
+
 	if (log_to_file) {
 		/* Create the log file now,
 		 * since we can infer the phone number
@@ -301,22 +438,61 @@ static void *handler(void *varg)
 	return NULL;
 }
 
-static void sigint_handler(int sig)
+static void dump_stats(void)
 {
-	(void) sig;
-	fprintf(stderr, "\n");
-	fprintf(stderr, "%-16s: %5d\n", "Calls Processed", calls_total);
-	fprintf(stderr, "%-16s: %5d\n", "Calls Succeeded", calls_success);
-	exit(EXIT_SUCCESS);
+	pthread_mutex_lock(&stats_lock);
+	stats_print(stderr, &stats);
+	if (*statsfile) {
+		stats_save(statsfile, &stats);
+	}
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/*!
+ * \brief Handle signals, in a thread of their own.
+ * These signals are blocked everywhere else, so this is free to
+ * take locks, allocate memory and use stdio, which handlers can't.
+ */
+static void *signal_thread(void *varg)
+{
+	sigset_t *signals = varg;
+	int sig;
+
+	for (;;) {
+		if (sigwait(signals, &sig)) {
+			continue;
+		}
+		fprintf(stderr, "\n");
+		if (sig == SIGUSR1) {
+			dump_stats();
+			continue;
+		}
+		fprintf(stderr, "%-16s: %5d\n", "Calls Processed", calls_total);
+		fprintf(stderr, "%-16s: %5d\n", "Calls Succeeded", calls_success);
+		fprintf(stderr, "%-16s: %5lu\n", "Numbers Tracked", history_count(&history));
+		if (*spooldir) {
+			fprintf(stderr, "%-16s: %5d\n", "Still Spooled", spool_pending());
+		}
+		dump_stats();
+		exit(EXIT_SUCCESS);
+	}
+	return NULL;
 }
 
 static int parse_options(int argc, char *argv[])
 {
-	static const char *getopt_settings = "f:lhpv";
+	static const char *getopt_settings = "ac:f:lhps:S:v";
 	int c;
 
 	while ((c = getopt(argc, argv, getopt_settings)) != -1) {
 		switch (c) {
+		case 'a':
+			tuning_enable();
+			break;
+		case 'c':
+			strncpy(journaldir, optarg, sizeof(journaldir) - 1);
+			journaldir[sizeof(journaldir) - 1] = '\0';
+			break;
 		case 'f':
 			strncpy(outputdir, optarg, sizeof(outputdir) - 1);
 			outputdir[sizeof(outputdir) - 1] = '\0';
@@ -327,14 +503,26 @@ static int parse_options(int argc, char *argv[])
 			break;
 		case 'h':
 			fprintf(stderr, "proteld [-options]\n");
+			fprintf(stderr, "   -a             Auto-tune abort deadline and corruption handling for each peer\n");
+			fprintf(stderr, "   -c directory   Keep checkpoints and change logs of the latest payload for each number here (see protelstate)\n");
 			fprintf(stderr, "   -f directory   Log printouts to this directory\n");
 			fprintf(stderr, "   -l             Listen only on localhost\n");
 			fprintf(stderr, "   -p port        Port on which to listen\n");
+			fprintf(stderr, "   -s directory   Spool printouts here (e.g. on tmpfs) and move them to the -f directory in the background\n");
+			fprintf(stderr, "   -S file        Save statistics to this file on exit or SIGUSR1 (and resume from it)\n");
 			fprintf(stderr, "   -v             Increase verbosity\n");
 			return -1;
 		case 'p':
 			listen_port = atoi(argv[optind++]);
 			break;
+		case 's':
+			strncpy(spooldir, optarg, sizeof(spooldir) - 1);
+			spooldir[sizeof(spooldir) - 1] = '\0';
+			break;
+		case 'S':
+			strncpy(statsfile, optarg, sizeof(statsfile) - 1);
+			statsfile[sizeof(statsfile) - 1] = '\0';
+			break;
 		case 'v':
 			debug_level++;
 			break;
@@ -349,8 +537,10 @@ static int parse_options(int argc, char *argv[])
 
 int main(int argc, char *argv[])
 {
+	static sigset_t signals;
 	struct sockaddr_in sinaddr;
 	socklen_t len;
+	pthread_t sigthread;
 	int sfd, res;
 	int sock;
 	const int enable = 1;
@@ -362,6 +552,35 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	/* Block these before starting any threads, so they all inherit the mask,
+	 * and only signal_thread ever receives them */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	if (*spooldir) {
+		if (!log_to_file) {
+			fprintf(stderr, "Spooling requires an output directory: -f <directory>\n");
+			return -1;
+		} else if (spool_start(spooldir, outputdir)) {
+			return -1;
+		}
+	}
+
+	if (history_init(&history, 1024)) {
+		fprintf(stderr, "Failed to allocate history\n");
+		return -1;
+	}
+	if (*journaldir && journal_start(journaldir, &history)) {
+		return -1;
+	}
+
+	stats_init(&stats);
+	if (*statsfile && !access(statsfile, R_OK) && stats_load(statsfile, &stats)) {
+		stats_init(&stats); /* Start over */
+	}
+
 	sock = socket(AF_INET, SOCK_STREAM, 0);
 	if (sock < 0) {
 		fprintf(stderr, "Unable to create TCP socket: %s\n", strerror(errno));
@@ -396,13 +615,21 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	signal(SIGINT, sigint_handler);
+	res = pthread_create(&sigthread, NULL, signal_thread, &signals);
+	if (res) {
+		fprintf(stderr, "pthread_create failed: %s\n", strerror(res));
+		close(sock);
+		return -1;
+	}
+	pthread_detach(sigthread);
 
 	fprintf(stderr, "Listening on port %d\n", listen_port);
 
 	for (;;) {
 		pthread_attr_t attr;
 		pthread_t thread;
+		struct conn *conn;
+		len = sizeof(sinaddr);
 		sfd = accept(sock, (struct sockaddr *) &sinaddr, &len);
 		if (sfd < 0) {
 			if (errno != EINTR) {
@@ -412,19 +639,30 @@ int main(int argc, char *argv[])
 			continue;
 		}
 
+		/* Each thread gets its own copy, since we're about to accept() again */
+		conn = malloc(sizeof(*conn));
+		if (!conn) {
+			fprintf(stderr, "malloc failed\n");
+			close(sfd);
+			continue;
+		}
+		conn->fd = sfd;
+		conn->addr = sinaddr;
+
 		/* Make the thread detached, since we're not going to join it, ever */
 		pthread_attr_init(&attr);
 		res = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 		if (res) {
 			fprintf(stderr, "pthread_attr_setdetachstate: %s\n", strerror(res));
+			free(conn);
 			close(sfd);
 			continue;
 		}
-		if (pthread_create(&thread, &attr, handler, &sfd)) {
+		if (pthread_create(&thread, &attr, handler, conn)) {
 			fprintf(stderr, "pthread_create failed: %s\n", strerror(errno));
+			free(conn);
 			close(sfd);
 		}
-		usleep(100000); /* Wait for thread to start and dereference sfd before we accept() and overwrite it */
 	}
 
 	close(sock);
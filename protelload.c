@@ -0,0 +1,450 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Load a list of numbers to call into a clean, indexed queue
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Campaign lists can have millions of rows, with duplicates and numbers
+ * that can't possibly be valid. This reads a list (one number per line,
+ * optionally with a leading 1 or +1), drops anything that isn't a valid
+ * NANP number, and sorts and deduplicates the rest.
+ *
+ * The output has one 10-digit number per line, so every record is
+ * exactly 11 bytes and record N starts at byte 11 * N.
+ * It can also be limited to one node's share of the numbers (see protelpart).
+ *
+ * $> protelload -o queue.txt campaign.csv
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "protel.h"
+#include "ring.h"
+
+/* 10-digit numbers fit in 34 bits, so 3 passes of 12 bits sort them */
+#define RADIX_BITS 12
+#define RADIX_PASSES 3
+
+#define RECORD_LENGTH (NUMBER_LENGTH + 1)
+
+static char outfile[512] = "";
+static char nodelist[1024] = "";
+static char downlist[1024] = "";
+static char selfname[256] = "";
+static struct ring_nodes nodes;
+static int vnodes = RING_DEFAULT_VNODES;
+static int debug_level = 0;
+
+static unsigned long invalid_format = 0;
+static unsigned long invalid_nanp = 0;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*!
+ * \brief Length of the run of digits at the start of s
+ * \param s
+ * \param len Number of readable bytes at s. Since lines end in a non-digit, this can extend past the line.
+ */
+static inline int digit_run(const char *s, size_t len)
+{
+	int n = 0;
+
+#if defined(__SSE2__)
+	/* Check 16 bytes at once: (c - '0') < 10, as an unsigned comparison,
+	 * done with signed compares by flipping the sign bit */
+	if (len >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) s);
+		__m128i d = _mm_xor_si128(_mm_sub_epi8(v, _mm_set1_epi8('0')), _mm_set1_epi8((char) 0x80));
+		int mask = _mm_movemask_epi8(_mm_cmplt_epi8(d, _mm_set1_epi8((char) (0x80 + 10))));
+		return mask == 0xFFFF ? 16 : __builtin_ctz(~mask);
+	}
+#endif
+
+	while ((size_t) n < len && s[n] >= '0' && s[n] <= '9') {
+		n++;
+	}
+	return n;
+}
+
+/*!
+ * \brief Validate a number against the NANP numbering rules
+ * \retval 1 if valid, 0 if not
+ */
+static int nanp_valid(uint64_t number)
+{
+	int npa = (int) (number / 10000000);
+	int nxx = (int) (number / 10000 % 1000);
+	int line = (int) (number % 10000);
+
+	if (npa < 200 || nxx < 200) {
+		return 0; /* Area code and exchange both start with 2-9 */
+	} else if (npa % 100 == 11 || nxx % 100 == 11) {
+		return 0; /* N11 codes are service codes */
+	} else if (npa / 10 % 10 == 9 || npa / 10 == 37 || npa / 10 == 96) {
+		return 0; /* N9X, 37X, and 96X are reserved area codes */
+	} else if (nxx == 555 && line >= 100 && line <= 199) {
+		return 0; /* Fictional */
+	}
+	return 1;
+}
+
+/*!
+ * \brief Parse all the numbers in a buffer
+ * \param buf
+ * \param len
+ * \param[out] numbers Must have room for one number per line
+ * \return Number of valid numbers
+ */
+static size_t parse_numbers(const char *buf, size_t len, uint64_t *numbers)
+{
+	const char *end = buf + len;
+	const char *s = buf;
+	size_t count = 0;
+
+	while (s < end) {
+		const char *eol = memchr(s, '\n', end - s);
+		const char *tmp;
+		uint64_t number = 0;
+		int i, digits;
+
+		if (!eol) {
+			eol = end;
+		}
+		while (s < eol && (*s == ' ' || *s == '\t' || *s == '"')) {
+			s++;
+		}
+		if (s < eol && *s == '+') {
+			s++;
+		}
+
+		digits = digit_run(s, end - s);
+		if (digits == NUMBER_LENGTH + 1 && *s == '1') {
+			s++;
+			digits--;
+		}
+
+		/* Anything after the number has to be a field separator, or the end */
+		tmp = s + digits;
+		if (digits != NUMBER_LENGTH || (tmp < eol && *tmp != ',' && *tmp != '\r' && *tmp != ' ' && *tmp != '\t' && *tmp != '"')) {
+			if (eol > s || digits) {
+				if (debug_level) {
+					fprintf(stderr, "Invalid number: %.*s\n", (int) (eol - s), s);
+				}
+				invalid_format++;
+			}
+			s = eol + 1;
+			continue;
+		}
+
+		for (i = 0; i < NUMBER_LENGTH; i++) {
+			number = number * 10 + (uint64_t) (s[i] - '0');
+		}
+		if (!nanp_valid(number)) {
+			if (debug_level) {
+				fprintf(stderr, "Not a valid NANP number: %010lu\n", number);
+			}
+			invalid_nanp++;
+		} else {
+			numbers[count++] = number;
+		}
+		s = eol + 1;
+	}
+	return count;
+}
+
+/*! \brief LSD radix sort, using tmp as scratch space */
+static void radix_sort(uint64_t *numbers, uint64_t *tmp, size_t count)
+{
+	static size_t counts[1 << RADIX_BITS];
+	uint64_t *src = numbers, *dst = tmp;
+	int pass;
+
+	for (pass = 0; pass < RADIX_PASSES; pass++) {
+		int shift = pass * RADIX_BITS;
+		size_t i, total = 0;
+		uint64_t *swap;
+
+		memset(counts, 0, sizeof(counts));
+		for (i = 0; i < count; i++) {
+			counts[(src[i] >> shift) & ((1 << RADIX_BITS) - 1)]++;
+		}
+		for (i = 0; i < (1 << RADIX_BITS); i++) {
+			size_t c = counts[i];
+			counts[i] = total;
+			total += c;
+		}
+		for (i = 0; i < count; i++) {
+			dst[counts[(src[i] >> shift) & ((1 << RADIX_BITS) - 1)]++] = src[i];
+		}
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	if (src != numbers) {
+		memcpy(numbers, src, count * sizeof(*numbers));
+	}
+}
+
+static size_t dedup(uint64_t *numbers, size_t count)
+{
+	size_t i, j;
+
+	if (!count) {
+		return 0;
+	}
+	for (i = j = 1; i < count; i++) {
+		if (numbers[i] != numbers[j - 1]) {
+			numbers[j++] = numbers[i];
+		}
+	}
+	return j;
+}
+
+/*!
+ * \brief Keep only this node's share of the numbers
+ * \retval 0 on success, -1 on failure
+ */
+static int partition(uint64_t *numbers, size_t *count)
+{
+	struct ring ring;
+	size_t i, j;
+
+	if (ring_init(&ring, nodes.names, nodes.count, nodes.down, vnodes)) {
+		fprintf(stderr, "Failed to build hash ring\n");
+		return -1;
+	}
+	for (i = j = 0; i < *count; i++) {
+		if (ring_lookup(&ring, numbers[i]) == nodes.self) {
+			numbers[j++] = numbers[i];
+		}
+	}
+	ring_destroy(&ring);
+	*count = j;
+	return 0;
+}
+
+static int write_queue(const uint64_t *numbers, size_t count)
+{
+	char buf[RECORD_LENGTH * 4096];
+	FILE *fp = stdout;
+	size_t i, pos = 0;
+	int res = 0;
+
+	if (*outfile) {
+		fp = fopen(outfile, "w");
+		if (!fp) {
+			fprintf(stderr, "fopen(%s) failed: %s\n", outfile, strerror(errno));
+			return -1;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		uint64_t n = numbers[i];
+		int d;
+		for (d = NUMBER_LENGTH - 1; d >= 0; d--) {
+			buf[pos + d] = (char) ('0' + n % 10);
+			n /= 10;
+		}
+		buf[pos + NUMBER_LENGTH] = '\n';
+		pos += RECORD_LENGTH;
+		if (pos == sizeof(buf) || i == count - 1) {
+			if (fwrite(buf, 1, pos, fp) != pos) {
+				fprintf(stderr, "Failed to write queue: %s\n", strerror(errno));
+				res = -1;
+				break;
+			}
+			pos = 0;
+		}
+	}
+
+	if (fp != stdout && fclose(fp)) {
+		fprintf(stderr, "Failed to write queue: %s\n", strerror(errno));
+		res = -1;
+	}
+	return res;
+}
+
+static int parse_options(int argc, char *argv[])
+{
+	static const char *getopt_settings = "hi:n:o:V:vx:";
+	int c;
+
+	while ((c = getopt(argc, argv, getopt_settings)) != -1) {
+		switch (c) {
+		case 'h':
+			fprintf(stderr, "protelload [-options] file\n");
+			fprintf(stderr, "   -i node        Output only the numbers for this node (requires -n)\n");
+			fprintf(stderr, "   -n nodes       Comma-separated list of all nodes\n");
+			fprintf(stderr, "   -o file        Write the queue to this file (default: stdout)\n");
+			fprintf(stderr, "   -V count       Virtual nodes per node (default %d), must match protelpart and every node\n", RING_DEFAULT_VNODES);
+			fprintf(stderr, "   -v             Increase verbosity\n");
+			fprintf(stderr, "   -x nodes       Comma-separated list of nodes that are down\n");
+			return -1;
+		case 'i':
+			strncpy(selfname, optarg, sizeof(selfname) - 1);
+			selfname[sizeof(selfname) - 1] = '\0';
+			break;
+		case 'n':
+			strncpy(nodelist, optarg, sizeof(nodelist) - 1);
+			nodelist[sizeof(nodelist) - 1] = '\0';
+			break;
+		case 'o':
+			strncpy(outfile, optarg, sizeof(outfile) - 1);
+			outfile[sizeof(outfile) - 1] = '\0';
+			break;
+		case 'V':
+			vnodes = atoi(optarg);
+			break;
+		case 'v':
+			debug_level++;
+			break;
+		case 'x':
+			strncpy(downlist, optarg, sizeof(downlist) - 1);
+			downlist[sizeof(downlist) - 1] = '\0';
+			break;
+		default:
+			fprintf(stderr, "Unknown option: %c\n", c);
+			return -1;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Must specify a file: protelload <file>\n");
+		return -1;
+	} else if (!*selfname != !*nodelist) {
+		fprintf(stderr, "-i and -n must be used together\n");
+		return -1;
+	} else if (vnodes < 1) {
+		fprintf(stderr, "Invalid number of virtual nodes: %d\n", vnodes);
+		return -1;
+	}
+	/* Validate the nodes up front, rather than after all the work */
+	return *nodelist ? ring_parse_nodes(&nodes, nodelist, downlist, selfname) : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct stat st;
+	struct rusage usage;
+	const char *data;
+	uint64_t *numbers, *tmp;
+	size_t lines = 0, parsed, unique, count, mem;
+	double t0, t1, t2, t3, t4;
+	const char *s;
+	int fd;
+
+	if (parse_options(argc, argv)) {
+		return -1;
+	}
+
+	t0 = now();
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "open(%s) failed: %s\n", argv[optind], strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		fprintf(stderr, "fstat(%s) failed: %s\n", argv[optind], strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if (!st.st_size) {
+		fprintf(stderr, "%s is empty\n", argv[optind]);
+		close(fd);
+		return -1;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "mmap(%s) failed: %s\n", argv[optind], strerror(errno));
+		return -1;
+	}
+	madvise((void *) data, st.st_size, MADV_SEQUENTIAL);
+
+	/* Size the arrays exactly, rather than growing them as we go */
+	for (s = data; (s = memchr(s, '\n', data + st.st_size - s)); s++) {
+		lines++;
+	}
+	lines++; /* In case the last line has no newline */
+
+	mem = 2 * lines * sizeof(uint64_t);
+	numbers = malloc(lines * sizeof(uint64_t));
+	tmp = malloc(lines * sizeof(uint64_t));
+	if (!numbers || !tmp) {
+		fprintf(stderr, "malloc failed\n");
+		free(numbers);
+		free(tmp);
+		munmap((void *) data, st.st_size);
+		return -1;
+	}
+
+	parsed = parse_numbers(data, st.st_size, numbers);
+	munmap((void *) data, st.st_size);
+	t1 = now();
+
+	radix_sort(numbers, tmp, parsed);
+	free(tmp);
+	count = unique = dedup(numbers, parsed);
+	t2 = now();
+
+	/* Fail before touching the output, rather than leaving an empty queue */
+	if (*nodelist && partition(numbers, &count)) {
+		free(numbers);
+		return -1;
+	}
+	t3 = now();
+
+	if (write_queue(numbers, count)) {
+		free(numbers);
+		return -1;
+	}
+	free(numbers);
+	t4 = now();
+
+	getrusage(RUSAGE_SELF, &usage);
+	fprintf(stderr, "%-16s: %10lu\n", "Invalid Format", invalid_format);
+	fprintf(stderr, "%-16s: %10lu\n", "Invalid NANP", invalid_nanp);
+	fprintf(stderr, "%-16s: %10lu\n", "Duplicates", parsed - unique);
+	if (*nodelist) {
+		fprintf(stderr, "%-16s: %10lu\n", "Other Nodes", unique - count);
+	}
+	fprintf(stderr, "%-16s: %10lu\n", "Queued", count);
+	fprintf(stderr, "Parsed in %.3f s, sorted in %.3f s, partitioned in %.3f s, written in %.3f s (%.3f s total)\n",
+		t1 - t0, t2 - t1, t3 - t2, t4 - t3, t4 - t0);
+	fprintf(stderr, "%.1f MB of number arrays (%.1f MB per million numbers), %.1f MB max RSS\n",
+		mem / 1048576.0, parsed ? mem / 1048576.0 / (parsed / 1e6) : 0, usage.ru_maxrss / 1024.0);
+	return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Split a list of numbers across multiple proteld nodes
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * When several proteld + Asterisk pairs share a list of numbers to call,
+ * each node runs this over the same list with the same node names,
+ * and gets back only the numbers it is responsible for.
+ * If a node goes down, rerun with that node excluded (-x):
+ * the numbers that belonged to it are spread across the others,
+ * and everyone else keeps the numbers they already had.
+ *
+ * $> protelpart -n east,west,central -i west numbers.txt > west.txt
+ * $> protelpart -n east,west,central -x central -i west numbers.txt > west.txt
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
+
+#include "protel.h"
+#include "ring.h"
+
+static struct ring_nodes nodes;
+static int vnodes = RING_DEFAULT_VNODES;
+static int summary = 0;
+static int debug_level = 0;
+
+static char nodelist[1024] = "";
+static char downlist[1024] = "";
+static char selfname[256] = "";
+
+/*!
+ * \brief Parse a phone number at the beginning of a line
+ * \retval 0 on success, -1 if not a 10-digit number (optionally with a leading 1)
+ */
+static int parse_number(const char *s, uint64_t *number)
+{
+	int digits = 0;
+
+	while (isspace(*s)) {
+		s++;
+	}
+	if (*s == '+') {
+		s++;
+	}
+	*number = 0;
+	while (isdigit(*s)) {
+		*number = *number * 10 + (uint64_t) (*s++ - '0');
+		digits++;
+	}
+	if (*s && !isspace(*s)) {
+		return -1;
+	}
+	if (digits == NUMBER_LENGTH + 1 && *number / 10000000000ULL == 1) {
+		*number -= 10000000000ULL;
+		digits--;
+	}
+	return digits == NUMBER_LENGTH ? 0 : -1;
+}
+
+static int parse_options(int argc, char *argv[])
+{
+	static const char *getopt_settings = "hi:n:sV:vx:";
+	int c;
+
+	while ((c = getopt(argc, argv, getopt_settings)) != -1) {
+		switch (c) {
+		case 'h':
+			fprintf(stderr, "protelpart [-options] [file]\n");
+			fprintf(stderr, "   -i node        Output only the numbers for this node (default: output every number and its node)\n");
+			fprintf(stderr, "   -n nodes       Comma-separated list of all nodes\n");
+			fprintf(stderr, "   -s             Print how many numbers each node gets\n");
+			fprintf(stderr, "   -V count       Virtual nodes per node (default %d), must be the same on every node\n", RING_DEFAULT_VNODES);
+			fprintf(stderr, "   -v             Increase verbosity\n");
+			fprintf(stderr, "   -x nodes       Comma-separated list of nodes that are down\n");
+			return -1;
+		case 'i':
+			strncpy(selfname, optarg, sizeof(selfname) - 1);
+			selfname[sizeof(selfname) - 1] = '\0';
+			break;
+		case 'n':
+			strncpy(nodelist, optarg, sizeof(nodelist) - 1);
+			nodelist[sizeof(nodelist) - 1] = '\0';
+			break;
+		case 's':
+			summary = 1;
+			break;
+		case 'V':
+			vnodes = atoi(optarg);
+			break;
+		case 'v':
+			debug_level++;
+			break;
+		case 'x':
+			strncpy(downlist, optarg, sizeof(downlist) - 1);
+			downlist[sizeof(downlist) - 1] = '\0';
+			break;
+		default:
+			fprintf(stderr, "Unknown option: %c\n", c);
+			return -1;
+		}
+	}
+
+	if (vnodes < 1) {
+		fprintf(stderr, "Invalid number of virtual nodes: %d\n", vnodes);
+		return -1;
+	}
+	return ring_parse_nodes(&nodes, nodelist, downlist, selfname);
+}
+
+int main(int argc, char *argv[])
+{
+	struct ring ring;
+	FILE *fp = stdin;
+	char line[256];
+	unsigned long counts[RING_MAX_NODES];
+	unsigned long invalid = 0;
+	int i;
+
+	if (parse_options(argc, argv)) {
+		return -1;
+	}
+
+	if (optind < argc) {
+		fp = fopen(argv[optind], "r");
+		if (!fp) {
+			fprintf(stderr, "fopen(%s) failed: %s\n", argv[optind], strerror(errno));
+			return -1;
+		}
+	}
+
+	if (ring_init(&ring, nodes.names, nodes.count, nodes.down, vnodes)) {
+		fprintf(stderr, "Failed to build hash ring\n");
+		return -1;
+	}
+
+	memset(counts, 0, sizeof(counts));
+	while (fgets(line, sizeof(line), fp)) {
+		uint64_t number;
+		int node;
+		if (parse_number(line, &number)) {
+			if (debug_level) {
+				fprintf(stderr, "Skipping invalid number: %s", line);
+			}
+			invalid++;
+			continue;
+		}
+		node = ring_lookup(&ring, number);
+		if (node < 0) {
+			fprintf(stderr, "All nodes are down\n");
+			break;
+		}
+		counts[node]++;
+		if (nodes.self < 0) {
+			printf("%010lu %s\n", number, nodes.names[node]);
+		} else if (node == nodes.self) {
+			printf("%010lu\n", number);
+		}
+	}
+
+	if (fp != stdin) {
+		fclose(fp);
+	}
+	ring_destroy(&ring);
+
+	if (summary) {
+		for (i = 0; i < nodes.count; i++) {
+			fprintf(stderr, "%-16s: %8lu%s\n", nodes.names[i], counts[i], nodes.down[i] ? " (down)" : "");
+		}
+		fprintf(stderr, "%-16s: %8lu\n", "Invalid", invalid);
+	}
+	return 0;
+}
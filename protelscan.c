@@ -0,0 +1,558 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Offline failure-mode analyzer for failed proteld captures
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * When proteld can't make sense of a call, it saves whatever it received
+ * to a <time>_<rand>_R.txt file. Over time, thousands of these pile up,
+ * and it's not obvious which are line noise, which are voice answers,
+ * and which are almost-good payloads that a better parser could recover.
+ *
+ * This tool featurizes every failed capture in a directory (in parallel),
+ * clusters them using mini-batch k-means, and prints the clusters
+ * ranked by size, along with a rough label and some example files.
+ * The largest clusters are the ones worth improving proteld for.
+ *
+ * Use like so:
+ *
+ * $> protelscan -k 8 printouts
+ */
+
+#define _GNU_SOURCE /* for memmem in string.h */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <float.h>
+
+#include "protel.h"
+
+/* Captures are never larger than proteld's receive buffer,
+ * but don't choke if something else ends up in the directory. */
+#define MAX_CAPTURE 4096
+
+/* Length used to normalize offsets and lengths, proteld's buffer size */
+#define NORM_LENGTH 512.0
+
+enum feature {
+	F_LENGTH = 0,	/* Capture length */
+	F_PREAMBLE,		/* "TC!" preamble present */
+	F_NUL,			/* Fraction of NUL bytes */
+	F_CONTROL,		/* Fraction of other control bytes */
+	F_PRINTABLE,	/* Fraction of printable bytes */
+	F_HIGH,			/* Fraction of bytes with the high bit set (usually noise) */
+	F_DIGITS,		/* Fraction of digits */
+	F_STARS,		/* Number of '*' delimiters, relative to a full payload */
+	F_FIRST_STAR,	/* Offset of the first '*' */
+	F_SCHEMA,		/* Fraction of expected delimiter positions that hold a '*' */
+	F_PAYLOAD,		/* Bytes received after the first '*', relative to a full payload */
+	F_RESETS,		/* Number of reset markers seen after the payload */
+	NUM_FEATURES,
+};
+
+struct capture {
+	char *name;
+	double f[NUM_FEATURES];
+	int cluster;
+	double dist;
+	int ok;
+};
+
+static char inputdir[512] = "";
+static int num_threads = 0;
+static int num_clusters = 8;
+static int num_examples = 3;
+static int batch_size = 256;
+static int iterations = 200;
+static int debug_level = 0;
+
+static struct capture *captures = NULL;
+static int num_captures = 0;
+static int next_capture = 0;
+
+static int featurize(struct capture *c, const unsigned char *buf, int len)
+{
+	static const int delims[] = DATA_DELIMITERS;
+	const unsigned char *star, *tmp;
+	int i, resets = 0;
+	int nul = 0, ctl = 0, print = 0, high = 0, digits = 0, stars = 0;
+
+	memset(c->f, 0, sizeof(c->f));
+
+	for (i = 0; i < len; i++) {
+		if (!buf[i]) {
+			nul++;
+		} else if (buf[i] >= 128) {
+			high++;
+		} else if (isprint(buf[i])) {
+			print++;
+			if (isdigit(buf[i])) {
+				digits++;
+			} else if (buf[i] == '*') {
+				stars++;
+			}
+		} else {
+			ctl++;
+		}
+	}
+
+	c->f[F_LENGTH] = len / NORM_LENGTH;
+	c->f[F_PREAMBLE] = memmem(buf, len, "TC!", 3) ? 1 : 0;
+	if (len) {
+		c->f[F_NUL] = (double) nul / len;
+		c->f[F_CONTROL] = (double) ctl / len;
+		c->f[F_PRINTABLE] = (double) print / len;
+		c->f[F_HIGH] = (double) high / len;
+		c->f[F_DIGITS] = (double) digits / len;
+	}
+	c->f[F_STARS] = stars > 2 * DATA_STARS ? 2 : (double) stars / DATA_STARS;
+
+	star = memchr(buf, '*', len);
+	if (star) {
+		int remaining = len - (star - buf);
+		int matched = 0;
+		c->f[F_FIRST_STAR] = (star - buf) / NORM_LENGTH;
+		for (i = 0; i < DATA_STARS; i++) {
+			if (delims[i] < remaining && star[delims[i]] == '*') {
+				matched++;
+			}
+		}
+		c->f[F_SCHEMA] = (double) matched / DATA_STARS;
+		c->f[F_PAYLOAD] = remaining >= DATA_LENGTH ? 1 : (double) remaining / DATA_LENGTH;
+	} else {
+		c->f[F_FIRST_STAR] = 1; /* As if it were past the end */
+	}
+
+	/* Same markers proteld uses to decide the payload was corrupted,
+	 * only counted after the first 30 bytes for the same reason. */
+	for (tmp = buf + 30; len > 30 && tmp + 3 <= buf + len; tmp++) {
+		if ((tmp[0] == 1 || tmp[0] == 0) && !tmp[1] && !tmp[2]) {
+			resets++;
+			tmp += 2;
+		}
+	}
+	c->f[F_RESETS] = resets > 8 ? 2 : resets / 4.0;
+	return 0;
+}
+
+static void *featurize_thread(void *varg)
+{
+	unsigned char buf[MAX_CAPTURE];
+	char path[1024];
+
+	(void) varg;
+
+	for (;;) {
+		struct capture *c;
+		int fd, len;
+		int i = __sync_fetch_and_add(&next_capture, 1);
+		if (i >= num_captures) {
+			break;
+		}
+		c = &captures[i];
+		snprintf(path, sizeof(path), "%s/%s", inputdir, c->name);
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, "open(%s) failed: %s\n", path, strerror(errno));
+			continue;
+		}
+		len = read(fd, buf, sizeof(buf));
+		close(fd);
+		if (len < 0) {
+			fprintf(stderr, "read(%s) failed: %s\n", path, strerror(errno));
+			continue;
+		}
+		if (!featurize(c, buf, len)) {
+			c->ok = 1;
+		}
+	}
+	return NULL;
+}
+
+static int load_captures(void)
+{
+	DIR *dir;
+	struct dirent *entry;
+	int alloced = 0;
+
+	dir = opendir(inputdir);
+	if (!dir) {
+		fprintf(stderr, "opendir(%s) failed: %s\n", inputdir, strerror(errno));
+		return -1;
+	}
+
+	while ((entry = readdir(dir))) {
+		size_t len = strlen(entry->d_name);
+		if (len < 6 || strcmp(entry->d_name + len - 6, "_R.txt")) {
+			continue; /* Not a failed capture */
+		}
+		if (num_captures == alloced) {
+			struct capture *newcaps;
+			alloced = alloced ? alloced * 2 : 1024;
+			newcaps = realloc(captures, alloced * sizeof(*captures));
+			if (!newcaps) {
+				fprintf(stderr, "realloc failed\n");
+				closedir(dir);
+				return -1;
+			}
+			captures = newcaps;
+		}
+		memset(&captures[num_captures], 0, sizeof(*captures));
+		captures[num_captures].name = strdup(entry->d_name);
+		if (!captures[num_captures].name) {
+			fprintf(stderr, "strdup failed\n");
+			closedir(dir);
+			return -1;
+		}
+		num_captures++;
+	}
+
+	closedir(dir);
+	return 0;
+}
+
+static int featurize_all(void)
+{
+	pthread_t *threads;
+	int i, j;
+
+	threads = calloc(num_threads, sizeof(*threads));
+	if (!threads) {
+		fprintf(stderr, "calloc failed\n");
+		return -1;
+	}
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, featurize_thread, NULL)) {
+			fprintf(stderr, "pthread_create failed: %s\n", strerror(errno));
+			break;
+		}
+	}
+	if (!i) {
+		free(threads);
+		return -1;
+	}
+	for (j = 0; j < i; j++) {
+		pthread_join(threads[j], NULL);
+	}
+	free(threads);
+
+	/* Drop anything we couldn't read */
+	for (i = j = 0; i < num_captures; i++) {
+		if (captures[i].ok) {
+			captures[j++] = captures[i];
+		} else {
+			free(captures[i].name);
+		}
+	}
+	num_captures = j;
+	return 0;
+}
+
+static inline double distance(const double *a, const double *b)
+{
+	double d = 0;
+	int i;
+
+	for (i = 0; i < NUM_FEATURES; i++) {
+		d += (a[i] - b[i]) * (a[i] - b[i]);
+	}
+	return d; /* Squared distance is fine for comparisons */
+}
+
+static int nearest(double (*centers)[NUM_FEATURES], const double *f, double *distp)
+{
+	double best = DBL_MAX;
+	int i, c = 0;
+
+	for (i = 0; i < num_clusters; i++) {
+		double d = distance(centers[i], f);
+		if (d < best) {
+			best = d;
+			c = i;
+		}
+	}
+	if (distp) {
+		*distp = best;
+	}
+	return c;
+}
+
+/*! \brief Mini-batch k-means (Sculley, 2010), seeded with k-means++ */
+static int cluster(double (*centers)[NUM_FEATURES])
+{
+	double *weights;
+	int *counts;
+	int *batch;
+	int i, j, it;
+
+	weights = calloc(num_captures, sizeof(*weights));
+	counts = calloc(num_clusters, sizeof(*counts));
+	batch = calloc(batch_size, sizeof(*batch));
+	if (!weights || !counts || !batch) {
+		fprintf(stderr, "calloc failed\n");
+		free(weights);
+		free(counts);
+		free(batch);
+		return -1;
+	}
+
+	/* k-means++ seeding, so that rare failure modes get a center of their own */
+	memcpy(centers[0], captures[rand() % num_captures].f, sizeof(centers[0]));
+	for (i = 1; i < num_clusters; i++) {
+		double total = 0, r;
+		for (j = 0; j < num_captures; j++) {
+			double d = distance(centers[0], captures[j].f);
+			int c;
+			for (c = 1; c < i; c++) {
+				double d2 = distance(centers[c], captures[j].f);
+				if (d2 < d) {
+					d = d2;
+				}
+			}
+			weights[j] = d;
+			total += d;
+		}
+		r = total * rand() / RAND_MAX;
+		for (j = 0; j < num_captures - 1 && r > weights[j]; j++) {
+			r -= weights[j];
+		}
+		memcpy(centers[i], captures[j].f, sizeof(centers[i]));
+	}
+
+	for (it = 0; it < iterations; it++) {
+		for (i = 0; i < batch_size; i++) {
+			batch[i] = rand() % num_captures;
+			captures[batch[i]].cluster = nearest(centers, captures[batch[i]].f, NULL);
+		}
+		for (i = 0; i < batch_size; i++) {
+			const struct capture *cap = &captures[batch[i]];
+			double *center = centers[cap->cluster];
+			double eta = 1.0 / ++counts[cap->cluster]; /* Per-center learning rate */
+			for (j = 0; j < NUM_FEATURES; j++) {
+				center[j] = (1 - eta) * center[j] + eta * cap->f[j];
+			}
+		}
+	}
+
+	for (i = 0; i < num_captures; i++) {
+		captures[i].cluster = nearest(centers, captures[i].f, &captures[i].dist);
+	}
+
+	free(weights);
+	free(counts);
+	free(batch);
+	return 0;
+}
+
+/*! \brief Rough, human-readable guess at what a cluster represents */
+static const char *cluster_label(const double *f)
+{
+	if (f[F_LENGTH] < 0.02) {
+		return "Empty or near-empty (no carrier / immediate hangup)";
+	} else if (f[F_HIGH] > 0.3 || f[F_PRINTABLE] < 0.3) {
+		return "Line noise or non-modem answer (voice, fax, SIT)";
+	} else if (f[F_SCHEMA] > 0.8 && f[F_PAYLOAD] > 0.9) {
+		return "Near-complete payload (parser/autocorrect could recover)";
+	} else if (f[F_SCHEMA] > 0.4 && f[F_PAYLOAD] < 0.9) {
+		return "Truncated payload (disconnected mid-printout)";
+	} else if (f[F_STARS] > 0.4 && f[F_SCHEMA] < 0.4) {
+		return "Delimiters misplaced (wrong format or dropped bytes)";
+	} else if (f[F_RESETS] > 0.4) {
+		return "Repeated corruption (reset markers)";
+	} else if (f[F_PREAMBLE] > 0.5) {
+		return "Preamble without payload";
+	}
+	return "Unclassified";
+}
+
+static int report(double (*centers)[NUM_FEATURES])
+{
+	int *sizes, *order;
+	int i, j;
+
+	sizes = calloc(num_clusters, sizeof(*sizes));
+	order = calloc(num_clusters, sizeof(*order));
+	if (!sizes || !order) {
+		fprintf(stderr, "calloc failed\n");
+		free(sizes);
+		free(order);
+		return -1;
+	}
+
+	for (i = 0; i < num_captures; i++) {
+		sizes[captures[i].cluster]++;
+	}
+	for (i = 0; i < num_clusters; i++) {
+		order[i] = i;
+	}
+	/* Rank by size. There are only a handful of clusters. */
+	for (i = 1; i < num_clusters; i++) {
+		for (j = i; j > 0 && sizes[order[j]] > sizes[order[j - 1]]; j--) {
+			int tmp = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = tmp;
+		}
+	}
+
+	printf("%d failed captures in %d clusters\n\n", num_captures, num_clusters);
+	for (i = 0; i < num_clusters; i++) {
+		int c = order[i];
+		const double *f = centers[c];
+		int shown = 0;
+
+		if (!sizes[c]) {
+			continue;
+		}
+		printf("#%d: %d captures (%.1f%%) - %s\n", i + 1, sizes[c], 100.0 * sizes[c] / num_captures, cluster_label(f));
+		printf("    length %.0f, preamble %.0f%%, printable %.0f%%, digits %.0f%%, high %.0f%%, NUL %.0f%%\n",
+			f[F_LENGTH] * NORM_LENGTH, 100 * f[F_PREAMBLE], 100 * f[F_PRINTABLE], 100 * f[F_DIGITS], 100 * f[F_HIGH], 100 * f[F_NUL]);
+		printf("    stars %.1f, schema match %.0f%%, payload %.0f%%, resets %.1f\n",
+			f[F_STARS] * DATA_STARS, 100 * f[F_SCHEMA], 100 * f[F_PAYLOAD], f[F_RESETS] * 4);
+
+		/* Show the examples that are most representative of the cluster */
+		while (shown < num_examples && shown < sizes[c]) {
+			double best = DBL_MAX;
+			int bestidx = -1;
+			for (j = 0; j < num_captures; j++) {
+				if (captures[j].cluster == c && captures[j].dist < best) {
+					best = captures[j].dist;
+					bestidx = j;
+				}
+			}
+			if (bestidx < 0) {
+				break;
+			}
+			printf("    e.g. %s\n", captures[bestidx].name);
+			captures[bestidx].dist = DBL_MAX; /* Don't pick it again */
+			shown++;
+		}
+		printf("\n");
+	}
+
+	free(sizes);
+	free(order);
+	return 0;
+}
+
+static int parse_options(int argc, char *argv[])
+{
+	static const char *getopt_settings = "b:e:hi:j:k:v";
+	int c;
+
+	while ((c = getopt(argc, argv, getopt_settings)) != -1) {
+		switch (c) {
+		case 'b':
+			batch_size = atoi(optarg);
+			break;
+		case 'e':
+			num_examples = atoi(optarg);
+			break;
+		case 'h':
+			fprintf(stderr, "protelscan [-options] directory\n");
+			fprintf(stderr, "   -b size        Mini-batch size (default %d)\n", batch_size);
+			fprintf(stderr, "   -e count       Example files to show per cluster (default %d)\n", num_examples);
+			fprintf(stderr, "   -i count       Mini-batch iterations (default %d)\n", iterations);
+			fprintf(stderr, "   -j threads     Number of threads for featurizing (default: number of CPUs)\n");
+			fprintf(stderr, "   -k clusters    Number of clusters (default %d)\n", num_clusters);
+			fprintf(stderr, "   -v             Increase verbosity\n");
+			return -1;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		case 'j':
+			num_threads = atoi(optarg);
+			break;
+		case 'k':
+			num_clusters = atoi(optarg);
+			break;
+		case 'v':
+			debug_level++;
+			break;
+		default:
+			fprintf(stderr, "Unknown option: %c\n", c);
+			return -1;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Must specify a directory: protelscan <directory>\n");
+		return -1;
+	}
+	strncpy(inputdir, argv[optind], sizeof(inputdir) - 1);
+	inputdir[sizeof(inputdir) - 1] = '\0';
+
+	if (num_clusters < 1 || batch_size < 1 || iterations < 0) {
+		fprintf(stderr, "Invalid clustering parameters\n");
+		return -1;
+	}
+	if (num_threads < 1) {
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (num_threads < 1) {
+			num_threads = 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	double (*centers)[NUM_FEATURES];
+	int i, res = -1;
+
+	if (parse_options(argc, argv)) {
+		return -1;
+	}
+
+	srand(1); /* Deterministic, so runs over the same archive are comparable */
+
+	if (load_captures() || featurize_all()) {
+		goto cleanup;
+	}
+	if (!num_captures) {
+		fprintf(stderr, "No failed captures found in %s\n", inputdir);
+		goto cleanup;
+	}
+	if (num_clusters > num_captures) {
+		num_clusters = num_captures;
+	}
+	if (debug_level) {
+		fprintf(stderr, "Featurized %d captures using %d threads\n", num_captures, num_threads);
+	}
+
+	centers = calloc(num_clusters, sizeof(*centers));
+	if (!centers) {
+		fprintf(stderr, "calloc failed\n");
+		goto cleanup;
+	}
+	if (!cluster(centers)) {
+		res = report(centers);
+	}
+	free(centers);
+
+cleanup:
+	for (i = 0; i < num_captures; i++) {
+		free(captures[i].name);
+	}
+	free(captures);
+	return res;
+}
@@ -0,0 +1,289 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Verify the checksums of saved captures
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * proteld stores a CRC32C of every capture it saves, so that corruption
+ * on disk can be told apart from corruption on the line.
+ * It's kept in an extended attribute, or in a name.crc32c file next to
+ * the capture on filesystems without them (e.g. NFSv3).
+ * This tool verifies every capture in a directory, using multiple threads,
+ * and reports (and optionally quarantines) any that don't match.
+ *
+ * It can be throttled to a fixed read rate, so that it can be left
+ * running in the background while proteld is saving captures, e.g.:
+ *
+ * $> nice ionice -c 3 protelscrub -r 4 -q quarantine printouts
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "crc32c.h"
+
+static char inputdir[512] = "";
+static char quarantinedir[512] = "";
+static int num_threads = 0;
+static double rate_limit = 0; /* Bytes per second, 0 for unlimited */
+static int debug_level = 0;
+
+static struct dirent **entries = NULL;
+static int num_entries = 0;
+static int next_entry = 0;
+
+static int files_ok = 0;
+static int files_unchecked = 0;
+static int files_damaged = 0;
+static int files_failed = 0;
+static unsigned long long bytes_total = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec start;
+
+static double elapsed(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double) (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*! \brief Account for bytes read, sleeping if we're ahead of the rate limit */
+static void throttle(size_t bytes)
+{
+	double ahead;
+
+	pthread_mutex_lock(&lock);
+	bytes_total += bytes;
+	ahead = rate_limit ? bytes_total / rate_limit - elapsed() : 0;
+	pthread_mutex_unlock(&lock);
+
+	if (ahead > 0) {
+		usleep((useconds_t) (ahead * 1000000));
+	}
+}
+
+static void quarantine(const char *path, const char *name)
+{
+	char dst[1024];
+
+	snprintf(dst, sizeof(dst), "%s/%s", quarantinedir, name);
+	if (crc32c_rename(path, dst)) {
+		fprintf(stderr, "Failed to quarantine %s: %s\n", path, strerror(errno));
+	} else {
+		fprintf(stderr, "Quarantined %s to %s\n", path, dst);
+	}
+}
+
+static void verify(const char *name)
+{
+	char path[1024];
+	char buf[65536];
+	uint32_t crc = 0, expected;
+	ssize_t res;
+	int fd, crc_error = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", inputdir, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "open(%s) failed: %s\n", path, strerror(errno));
+		__sync_fetch_and_add(&files_failed, 1);
+		return;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if (crc32c_get(fd, path, &expected)) {
+		crc_error = errno;
+	}
+	while ((res = read(fd, buf, sizeof(buf))) > 0) {
+		crc = crc32c(crc, buf, res);
+		throttle(res);
+	}
+
+	/* Don't push the daemon's working set out of the page cache */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+
+	if (res < 0) {
+		fprintf(stderr, "read(%s) failed: %s\n", path, strerror(errno));
+		__sync_fetch_and_add(&files_failed, 1);
+	} else if (crc_error == ENODATA || crc_error == ENOTSUP) {
+		if (debug_level) {
+			fprintf(stderr, "%s has no checksum\n", path);
+		}
+		__sync_fetch_and_add(&files_unchecked, 1);
+	} else if (crc_error == EINVAL) {
+		/* The checksum itself is damaged, so the capture can't be trusted either */
+		printf("%s: DAMAGED (malformed checksum)\n", name);
+		__sync_fetch_and_add(&files_damaged, 1);
+		if (*quarantinedir) {
+			quarantine(path, name);
+		}
+	} else if (crc_error) {
+		fprintf(stderr, "Failed to read checksum of %s: %s\n", path, strerror(crc_error));
+		__sync_fetch_and_add(&files_failed, 1);
+	} else if (crc != expected) {
+		printf("%s: DAMAGED (computed %08x, stored %08x)\n", name, crc, expected);
+		__sync_fetch_and_add(&files_damaged, 1);
+		if (*quarantinedir) {
+			quarantine(path, name);
+		}
+	} else {
+		if (debug_level > 1) {
+			fprintf(stderr, "%s: OK\n", path);
+		}
+		__sync_fetch_and_add(&files_ok, 1);
+	}
+}
+
+static void *scrub_thread(void *varg)
+{
+	(void) varg;
+
+	for (;;) {
+		int i = __sync_fetch_and_add(&next_entry, 1);
+		if (i >= num_entries) {
+			break;
+		}
+		verify(entries[i]->d_name);
+	}
+	return NULL;
+}
+
+static int capture_filter(const struct dirent *entry)
+{
+	/* Skip hidden files, which includes in-progress copies from the spool,
+	 * and the checksums of captures on filesystems without extended attributes */
+	return entry->d_name[0] != '.' && !crc32c_is_sidecar(entry->d_name) && (entry->d_type == DT_REG || entry->d_type == DT_UNKNOWN);
+}
+
+static int parse_options(int argc, char *argv[])
+{
+	static const char *getopt_settings = "hj:q:r:v";
+	int c;
+
+	while ((c = getopt(argc, argv, getopt_settings)) != -1) {
+		switch (c) {
+		case 'h':
+			fprintf(stderr, "protelscrub [-options] directory\n");
+			fprintf(stderr, "   -j threads     Number of threads (default: number of CPUs)\n");
+			fprintf(stderr, "   -q directory   Move damaged captures to this directory\n");
+			fprintf(stderr, "   -r MB/s        Limit reading to this rate (default: unlimited)\n");
+			fprintf(stderr, "   -v             Increase verbosity\n");
+			return -1;
+		case 'j':
+			num_threads = atoi(optarg);
+			break;
+		case 'q':
+			strncpy(quarantinedir, optarg, sizeof(quarantinedir) - 1);
+			quarantinedir[sizeof(quarantinedir) - 1] = '\0';
+			break;
+		case 'r':
+			rate_limit = atof(optarg) * 1024 * 1024;
+			break;
+		case 'v':
+			debug_level++;
+			break;
+		default:
+			fprintf(stderr, "Unknown option: %c\n", c);
+			return -1;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Must specify a directory: protelscrub <directory>\n");
+		return -1;
+	}
+	strncpy(inputdir, argv[optind], sizeof(inputdir) - 1);
+	inputdir[sizeof(inputdir) - 1] = '\0';
+
+	if (num_threads < 1) {
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (num_threads < 1) {
+			num_threads = 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t *threads;
+	double secs;
+	int i, j;
+
+	if (parse_options(argc, argv)) {
+		return -1;
+	}
+
+	num_entries = scandir(inputdir, &entries, capture_filter, NULL);
+	if (num_entries < 0) {
+		fprintf(stderr, "scandir(%s) failed: %s\n", inputdir, strerror(errno));
+		return -1;
+	}
+
+	threads = calloc(num_threads, sizeof(*threads));
+	if (!threads) {
+		fprintf(stderr, "calloc failed\n");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, scrub_thread, NULL)) {
+			fprintf(stderr, "pthread_create failed: %s\n", strerror(errno));
+			break;
+		}
+	}
+	if (!i) {
+		scrub_thread(NULL); /* Do it ourselves, then */
+	}
+	for (j = 0; j < i; j++) {
+		pthread_join(threads[j], NULL);
+	}
+	secs = elapsed();
+	free(threads);
+
+	for (i = 0; i < num_entries; i++) {
+		free(entries[i]);
+	}
+	free(entries);
+
+	fprintf(stderr, "%-16s: %5d\n", "Captures OK", files_ok);
+	fprintf(stderr, "%-16s: %5d\n", "Damaged", files_damaged);
+	fprintf(stderr, "%-16s: %5d\n", "No Checksum", files_unchecked);
+	fprintf(stderr, "%-16s: %5d\n", "Unreadable", files_failed);
+	fprintf(stderr, "Verified %llu bytes in %.2f s (%.1f MB/s)\n", bytes_total, secs, secs > 0 ? bytes_total / secs / (1024 * 1024) : 0);
+
+	/* Not finding any damage isn't the same as the archive being intact */
+	if (files_unchecked && !files_ok && !files_damaged) {
+		fprintf(stderr, "WARNING: None of the captures have a checksum, so nothing was verified\n");
+		return 1;
+	} else if (files_unchecked > files_ok + files_damaged) {
+		fprintf(stderr, "WARNING: Most of the captures (%d) have no checksum, and weren't verified\n", files_unchecked);
+	}
+	return files_damaged || files_failed ? 1 : 0;
+}
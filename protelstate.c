@@ -0,0 +1,164 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Show what every number reported as of a point in time
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Rebuilds the latest payload for each number from the checkpoints
+ * and change logs proteld keeps with -c, by loading the nearest
+ * checkpoint and replaying only the changes after it.
+ * Prints one line per number, sorted by number:
+ * the time the payload was first seen, then the payload.
+ *
+ * $> protelstate -t 2024-06-01 /var/lib/protel/journal
+ */
+
+#define _GNU_SOURCE /* for strptime and timegm */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "journal.h"
+
+static time_t until = 0;
+static uint64_t only_number = 0;
+static int debug_level = 0;
+
+static int parse_time(const char *s, time_t *t)
+{
+	struct tm tm;
+	const char *end;
+
+	/* Either a UNIX timestamp, or a date (and time) in UTC */
+	memset(&tm, 0, sizeof(tm));
+	end = strptime(s, "%Y-%m-%d %H:%M:%S", &tm);
+	if (!end) {
+		memset(&tm, 0, sizeof(tm));
+		end = strptime(s, "%Y-%m-%d", &tm);
+	}
+	if (end && !*end) {
+		*t = timegm(&tm);
+		return 0;
+	}
+	*t = strtol(s, (char **) &end, 10);
+	return end != s && !*end ? 0 : -1;
+}
+
+static int parse_options(int argc, char *argv[])
+{
+	static const char *getopt_settings = "hn:t:v";
+	int c;
+
+	while ((c = getopt(argc, argv, getopt_settings)) != -1) {
+		switch (c) {
+		case 'h':
+			fprintf(stderr, "protelstate [-options] directory\n");
+			fprintf(stderr, "   -n number      Only show this number\n");
+			fprintf(stderr, "   -t time        Show the state as of this time (UNIX timestamp, or YYYY-MM-DD [HH:MM:SS] in UTC). Default is now.\n");
+			fprintf(stderr, "   -v             Increase verbosity\n");
+			return -1;
+		case 'n':
+			only_number = strtoull(optarg, NULL, 10);
+			break;
+		case 't':
+			if (parse_time(optarg, &until)) {
+				fprintf(stderr, "Invalid time: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'v':
+			debug_level++;
+			break;
+		default:
+			fprintf(stderr, "Unknown option: %c\n", c);
+			return -1;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Must specify the journal directory: protelstate <directory>\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+	return payload_cmp(&((const struct history_entry *) a)->payload, &((const struct history_entry *) b)->payload);
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double) (now.tv_sec - start->tv_sec) * 1000 + (double) (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+int main(int argc, char *argv[])
+{
+	struct history history;
+	struct history_entry *entries;
+	struct timespec start;
+	char payload[DATA_LENGTH + 1];
+	time_t checkpoint;
+	size_t i, count;
+	long replayed;
+
+	if (parse_options(argc, argv)) {
+		return -1;
+	}
+	if (!until) {
+		until = time(NULL);
+	}
+
+	if (history_init(&history, 1024)) {
+		fprintf(stderr, "Failed to allocate history\n");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	replayed = journal_load(argv[optind], &history, until, &checkpoint);
+	if (replayed < 0) {
+		return -1;
+	}
+	if (debug_level) {
+		fprintf(stderr, "Loaded checkpoint %ld and replayed %ld changes in %.1f ms\n", (long) checkpoint, replayed, elapsed_ms(&start));
+	}
+
+	entries = history_snapshot(&history, &count, NULL, NULL);
+	if (!entries) {
+		fprintf(stderr, "malloc failed\n");
+		return -1;
+	}
+	/* The number comes first, so this sorts by number */
+	qsort(entries, count, sizeof(*entries), entry_cmp);
+
+	for (i = 0; i < count; i++) {
+		if (only_number && payload_number(&entries[i].payload) != only_number) {
+			continue;
+		}
+		payload_unpack(&entries[i].payload, payload);
+		printf("%ld %s\n", (long) entries[i].updated, payload);
+	}
+
+	free(entries);
+	history_destroy(&history);
+	return 0;
+}
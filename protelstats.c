@@ -0,0 +1,88 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Merge and print statistics saved by proteld
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Each proteld node saves its statistics with -S.
+ * This combines any number of those files into fleet-wide statistics,
+ * and can save the result, so shards can be merged in stages.
+ *
+ * $> protelstats -o fleet.stats east.stats west.stats
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "stats.h"
+
+static char outfile[512] = "";
+
+static int parse_options(int argc, char *argv[])
+{
+	static const char *getopt_settings = "ho:";
+	int c;
+
+	while ((c = getopt(argc, argv, getopt_settings)) != -1) {
+		switch (c) {
+		case 'h':
+			fprintf(stderr, "protelstats [-options] file [file...]\n");
+			fprintf(stderr, "   -o file        Save the merged statistics to this file\n");
+			return -1;
+		case 'o':
+			strncpy(outfile, optarg, sizeof(outfile) - 1);
+			outfile[sizeof(outfile) - 1] = '\0';
+			break;
+		default:
+			fprintf(stderr, "Unknown option: %c\n", c);
+			return -1;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Must specify at least one file: protelstats <file>\n");
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	/* These are somewhat large for the stack */
+	static struct fleet_stats merged, stats;
+	int i;
+
+	if (parse_options(argc, argv)) {
+		return -1;
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (stats_load(argv[i], i == optind ? &merged : &stats)) {
+			return -1;
+		}
+		if (i != optind) {
+			stats_merge(&merged, &stats);
+		}
+	}
+
+	stats_print(stdout, &merged);
+	if (*outfile && stats_save(outfile, &merged)) {
+		return -1;
+	}
+	return 0;
+}
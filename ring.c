@@ -0,0 +1,178 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Consistent hashing of phone numbers across proteld nodes
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Each node is placed on a 64-bit hash ring at many points (virtual nodes),
+ * and a number belongs to the first node point at or after its own hash.
+ * Only node names are hashed, so every node computes the same ring
+ * without coordinating, and removing a node only moves its own numbers,
+ * spread roughly evenly over the remaining nodes.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ring.h"
+
+/*! \brief MurmurHash3 finalizer, to spread out similar inputs */
+static inline uint64_t mix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint64_t hash_vnode(const char *name, int vnode)
+{
+	uint64_t h = 0xCBF29CE484222325ULL; /* FNV-1a */
+
+	while (*name) {
+		h ^= (unsigned char) *name++;
+		h *= 0x100000001B3ULL;
+	}
+	return mix64(h ^ (uint64_t) vnode * 0x9E3779B97F4A7C15ULL);
+}
+
+static int find_node(const struct ring_nodes *n, const char *name)
+{
+	int i;
+
+	for (i = 0; i < n->count; i++) {
+		if (!strcmp(n->names[i], name)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int ring_parse_nodes(struct ring_nodes *n, char *nodelist, char *downlist, const char *self)
+{
+	char *node, *next = nodelist;
+	int i;
+
+	memset(n, 0, sizeof(*n));
+	n->self = -1;
+
+	while ((node = strsep(&next, ","))) {
+		if (!*node) {
+			continue;
+		} else if (n->count == RING_MAX_NODES) {
+			fprintf(stderr, "Too many nodes (max %d)\n", RING_MAX_NODES);
+			return -1;
+		} else if (find_node(n, node) >= 0) {
+			/* A duplicate would get twice the share on some nodes and not others */
+			fprintf(stderr, "Duplicate node %s\n", node);
+			return -1;
+		}
+		n->names[n->count++] = node;
+	}
+	if (!n->count) {
+		fprintf(stderr, "Must specify at least one node: -n <node>,<node>,...\n");
+		return -1;
+	}
+
+	next = downlist;
+	while ((node = strsep(&next, ","))) {
+		if (!*node) {
+			continue;
+		}
+		i = find_node(n, node);
+		if (i < 0) {
+			fprintf(stderr, "Unknown node %s\n", node);
+			return -1;
+		}
+		n->down[i] = 1;
+	}
+
+	if (*self) {
+		n->self = find_node(n, self);
+		if (n->self < 0) {
+			fprintf(stderr, "Node %s is not in the node list\n", self);
+			return -1;
+		} else if (n->down[n->self]) {
+			fprintf(stderr, "Node %s is marked down, it has no numbers\n", self);
+		}
+	}
+	return 0;
+}
+
+static int point_cmp(const void *a, const void *b)
+{
+	const struct ring_point *pa = a, *pb = b;
+
+	if (pa->hash != pb->hash) {
+		return pa->hash < pb->hash ? -1 : 1;
+	}
+	return pa->node - pb->node;
+}
+
+int ring_init(struct ring *r, char *const *nodes, int num_nodes, const int *down, int vnodes)
+{
+	int i, v;
+
+	r->num_points = 0;
+	r->points = calloc((size_t) num_nodes * vnodes, sizeof(*r->points));
+	if (!r->points) {
+		return -1;
+	}
+
+	for (i = 0; i < num_nodes; i++) {
+		if (down && down[i]) {
+			continue;
+		}
+		for (v = 0; v < vnodes; v++) {
+			r->points[r->num_points].hash = hash_vnode(nodes[i], v);
+			r->points[r->num_points].node = i;
+			r->num_points++;
+		}
+	}
+
+	qsort(r->points, r->num_points, sizeof(*r->points), point_cmp);
+	return 0;
+}
+
+void ring_destroy(struct ring *r)
+{
+	free(r->points);
+	r->points = NULL;
+	r->num_points = 0;
+}
+
+int ring_lookup(const struct ring *r, uint64_t number)
+{
+	uint64_t h = mix64(number);
+	int lo = 0, hi = r->num_points;
+
+	if (!r->num_points) {
+		return -1;
+	}
+
+	/* First point with a hash >= h */
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (r->points[mid].hash < h) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return r->points[lo == r->num_points ? 0 : lo].node;
+}
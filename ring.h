@@ -0,0 +1,80 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Consistent hashing of phone numbers across proteld nodes
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#ifndef _PROTEL_RING_H
+#define _PROTEL_RING_H
+
+#include <stdint.h>
+
+/*! \brief Default number of virtual nodes per node */
+#define RING_DEFAULT_VNODES 160
+
+/*! \brief Maximum number of nodes */
+#define RING_MAX_NODES 64
+
+/*! \brief Nodes, as given on the command line */
+struct ring_nodes {
+	char *names[RING_MAX_NODES];
+	int down[RING_MAX_NODES];	/*!< Non-zero for nodes that are down */
+	int count;
+	int self;					/*!< Index of this node, or -1 if not given */
+};
+
+struct ring_point {
+	uint64_t hash;
+	int node;
+};
+
+struct ring {
+	struct ring_point *points;
+	int num_points;
+};
+
+/*!
+ * \brief Parse and validate lists of nodes, so every tool agrees on what's valid
+ * \param n
+ * \param nodelist Comma-separated list of all nodes. This is modified, and n points into it.
+ * \param downlist Comma-separated list of nodes that are down. Also modified.
+ * \param self Name of this node, or empty if not given
+ * \retval 0 on success, -1 if any list is invalid (after saying why)
+ */
+int ring_parse_nodes(struct ring_nodes *n, char *nodelist, char *downlist, const char *self);
+
+/*!
+ * \brief Build a hash ring
+ * \param r
+ * \param nodes Names of all the nodes. Every node must use the same names, in any order.
+ * \param num_nodes
+ * \param down If non-NULL, nodes for which this is non-zero are left out of the ring
+ * \param vnodes Number of virtual nodes per node
+ * \retval 0 on success, -1 on failure
+ * \note Leaving nodes out only moves the numbers that belonged to them
+ */
+int ring_init(struct ring *r, char *const *nodes, int num_nodes, const int *down, int vnodes);
+
+/*! \brief Free a hash ring */
+void ring_destroy(struct ring *r);
+
+/*!
+ * \brief Find the node responsible for a phone number
+ * \return Index into the nodes passed to ring_init, or -1 if no nodes are up
+ */
+int ring_lookup(const struct ring *r, uint64_t number);
+
+#endif /* _PROTEL_RING_H */
@@ -0,0 +1,231 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Fixed-size, mergeable probabilistic sketches
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Updates are constant time, memory is constant regardless of how many
+ * calls are made, and sketches from different nodes (or days) can be
+ * merged into one, so fleet-wide statistics don't require scanning
+ * the saved captures.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "sketch.h"
+
+/*! \brief MurmurHash3 finalizer, so that similar numbers hash very differently */
+static inline uint64_t mix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+void hll_add(struct hll *h, uint64_t item)
+{
+	uint64_t hash = mix64(item);
+	unsigned int index = (unsigned int) (hash >> (64 - HLL_BITS));
+	uint64_t rest = hash << HLL_BITS;
+	uint8_t rank = (uint8_t) (rest ? __builtin_clzll(rest) + 1 : 64 - HLL_BITS + 1);
+
+	if (rank > h->registers[index]) {
+		h->registers[index] = rank;
+	}
+}
+
+void hll_merge(struct hll *h, const struct hll *other)
+{
+	int i;
+
+	for (i = 0; i < HLL_REGISTERS; i++) {
+		if (other->registers[i] > h->registers[i]) {
+			h->registers[i] = other->registers[i];
+		}
+	}
+}
+
+double hll_estimate(const struct hll *h)
+{
+	const double m = HLL_REGISTERS;
+	double sum = 0, estimate;
+	int i, zeros = 0;
+
+	for (i = 0; i < HLL_REGISTERS; i++) {
+		sum += ldexp(1.0, -h->registers[i]);
+		zeros += !h->registers[i];
+	}
+
+	estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+	if (estimate <= 2.5 * m && zeros) {
+		/* Linear counting is more accurate for small counts */
+		estimate = m * log(m / zeros);
+	}
+	return estimate;
+}
+
+static inline unsigned int cms_index(int row, uint64_t item)
+{
+	return (unsigned int) (mix64(item ^ (0x9E3779B97F4A7C15ULL * (uint64_t) (row + 1))) % CMS_WIDTH);
+}
+
+uint32_t cms_add(struct cms *c, uint64_t item)
+{
+	uint32_t min = cms_estimate(c, item) + 1;
+	int i;
+
+	/* Conservative update: only raise the counters that are too low */
+	for (i = 0; i < CMS_DEPTH; i++) {
+		uint32_t *count = &c->counts[i][cms_index(i, item)];
+		if (*count < min) {
+			*count = min;
+		}
+	}
+	return min;
+}
+
+uint32_t cms_estimate(const struct cms *c, uint64_t item)
+{
+	uint32_t min = UINT32_MAX;
+	int i;
+
+	for (i = 0; i < CMS_DEPTH; i++) {
+		uint32_t count = c->counts[i][cms_index(i, item)];
+		if (count < min) {
+			min = count;
+		}
+	}
+	return min;
+}
+
+void cms_merge(struct cms *c, const struct cms *other)
+{
+	int i, j;
+
+	for (i = 0; i < CMS_DEPTH; i++) {
+		for (j = 0; j < CMS_WIDTH; j++) {
+			c->counts[i][j] += other->counts[i][j];
+		}
+	}
+}
+
+void topk_offer(struct topk *t, uint64_t item, uint32_t count)
+{
+	int i, min = 0;
+
+	for (i = 0; i < t->num_items; i++) {
+		if (t->items[i] == item) {
+			t->counts[i] = count;
+			return;
+		}
+		if (t->counts[i] < t->counts[min]) {
+			min = i;
+		}
+	}
+	if (t->num_items < TOPK_SIZE) {
+		min = t->num_items++;
+	} else if (count <= t->counts[min]) {
+		return;
+	}
+	t->items[min] = item;
+	t->counts[min] = count;
+}
+
+void topk_merge(struct topk *t, const struct topk *other, const struct cms *c)
+{
+	struct topk old = *t;
+	int i;
+
+	/* Re-rank both sets of candidates by their merged counts */
+	t->num_items = 0;
+	for (i = 0; i < old.num_items; i++) {
+		topk_offer(t, old.items[i], cms_estimate(c, old.items[i]));
+	}
+	for (i = 0; i < other->num_items; i++) {
+		topk_offer(t, other->items[i], cms_estimate(c, other->items[i]));
+	}
+}
+
+void topk_sort(struct topk *t)
+{
+	int i, j;
+
+	for (i = 1; i < t->num_items; i++) {
+		for (j = i; j > 0 && t->counts[j] > t->counts[j - 1]; j--) {
+			uint64_t item = t->items[j];
+			uint32_t count = t->counts[j];
+			t->items[j] = t->items[j - 1];
+			t->counts[j] = t->counts[j - 1];
+			t->items[j - 1] = item;
+			t->counts[j - 1] = count;
+		}
+	}
+}
+
+#define GAMMA ((1 + QUANTILE_ACCURACY) / (1 - QUANTILE_ACCURACY))
+
+void quantiles_add(struct quantiles *q, double value)
+{
+	int index;
+
+	q->count++;
+	if (value < 1) {
+		q->zeros++; /* Fields are non-negative integers, so this is 0 */
+		return;
+	}
+	index = (int) ceil(log(value) / log(GAMMA));
+	if (index >= QUANTILE_BUCKETS) {
+		index = QUANTILE_BUCKETS - 1;
+	}
+	q->buckets[index]++;
+}
+
+void quantiles_merge(struct quantiles *q, const struct quantiles *other)
+{
+	int i;
+
+	q->count += other->count;
+	q->zeros += other->zeros;
+	for (i = 0; i < QUANTILE_BUCKETS; i++) {
+		q->buckets[i] += other->buckets[i];
+	}
+}
+
+double quantiles_estimate(const struct quantiles *q, double p)
+{
+	uint64_t rank, seen;
+	int i;
+
+	if (!q->count) {
+		return 0;
+	}
+	rank = (uint64_t) (p * (q->count - 1));
+	seen = q->zeros;
+	if (rank < seen) {
+		return 0;
+	}
+	for (i = 0; i < QUANTILE_BUCKETS; i++) {
+		seen += q->buckets[i];
+		if (rank < seen) {
+			/* Middle of the bucket, which is within the accuracy of every value in it */
+			return 2 * pow(GAMMA, i) / (GAMMA + 1);
+		}
+	}
+	return pow(GAMMA, QUANTILE_BUCKETS - 1);
+}
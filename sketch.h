@@ -0,0 +1,95 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Fixed-size, mergeable probabilistic sketches
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#ifndef _PROTEL_SKETCH_H
+#define _PROTEL_SKETCH_H
+
+#include <stdint.h>
+
+/* All of these are plain structs with no pointers,
+ * so they can be written to and read from files as is. */
+
+/*! \brief HyperLogLog, for counting distinct items */
+#define HLL_BITS 12
+#define HLL_REGISTERS (1 << HLL_BITS)
+
+struct hll {
+	uint8_t registers[HLL_REGISTERS];
+};
+
+void hll_add(struct hll *h, uint64_t item);
+void hll_merge(struct hll *h, const struct hll *other);
+double hll_estimate(const struct hll *h);
+
+/*! \brief Count-Min sketch, for estimating how often items occur */
+#define CMS_DEPTH 4
+#define CMS_WIDTH 1024
+
+struct cms {
+	uint32_t counts[CMS_DEPTH][CMS_WIDTH];
+};
+
+/*! \return Estimated count of the item, after adding it */
+uint32_t cms_add(struct cms *c, uint64_t item);
+uint32_t cms_estimate(const struct cms *c, uint64_t item);
+void cms_merge(struct cms *c, const struct cms *other);
+
+/*! \brief The most frequent items seen by a Count-Min sketch */
+#define TOPK_SIZE 10
+
+struct topk {
+	uint64_t items[TOPK_SIZE];
+	uint32_t counts[TOPK_SIZE];
+	int num_items;
+};
+
+/*! \brief Offer an item, with its current estimated count */
+void topk_offer(struct topk *t, uint64_t item, uint32_t count);
+
+/*!
+ * \brief Merge top-k lists
+ * \param t
+ * \param other
+ * \param c The merged Count-Min sketch both lists were based on
+ */
+void topk_merge(struct topk *t, const struct topk *other, const struct cms *c);
+
+/*! \brief Sort a top-k list, most frequent first */
+void topk_sort(struct topk *t);
+
+/*!
+ * \brief Log-bucketed histogram for estimating quantiles,
+ * with values accurate to within QUANTILE_ACCURACY (relative).
+ */
+#define QUANTILE_ACCURACY 0.02
+#define QUANTILE_BUCKETS 1024
+
+struct quantiles {
+	uint64_t count;
+	uint64_t zeros;
+	uint32_t buckets[QUANTILE_BUCKETS];
+};
+
+void quantiles_add(struct quantiles *q, double value);
+void quantiles_merge(struct quantiles *q, const struct quantiles *other);
+
+/*! \param p Quantile, between 0 and 1 */
+double quantiles_estimate(const struct quantiles *q, double p);
+
+#endif /* _PROTEL_SKETCH_H */
@@ -0,0 +1,378 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Spool for captures, migrated to the output directory in the background
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * If the output directory is on slow (e.g. network) storage,
+ * writing a capture can take a while, and we'd rather not do that
+ * while handling a call. Instead, captures can be written to a spool
+ * directory on fast local storage (e.g. tmpfs), and this thread moves
+ * them to the output directory, oldest first, retrying on failure.
+ *
+ * Captures are written to the spool as name.tmp and renamed once complete,
+ * so the migrator never sees a partial capture. Anything in the spool
+ * at startup (e.g. after a crash) is migrated before anything new.
+ */
+
+#define _GNU_SOURCE /* for O_DIRECTORY */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "spool.h"
+#include "crc32c.h"
+
+/* Longest we'll wait between retries if the output directory is unavailable */
+#define MAX_RETRY_DELAY 64
+
+static char spool_dir[512] = "";
+static char dest_dir[512] = "";
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int spooled = 0; /* Captures in the spool, or reserved */
+static int dirty = 0; /* New captures have been committed */
+static int cross_device = 0; /* Can't rename into the output directory, must copy */
+static int checksum_warned = 0;
+
+static int is_tmp(const char *name)
+{
+	size_t len = strlen(name);
+	return len > 4 && !strcmp(name + len - 4, ".tmp");
+}
+
+static int spool_filter(const struct dirent *entry)
+{
+	return entry->d_name[0] != '.' && !is_tmp(entry->d_name) && !crc32c_is_sidecar(entry->d_name);
+}
+
+static int copy_file(const char *src, const char *name)
+{
+	char tmpname[1024], dst[1024];
+	char buf[4096];
+	int sfd, dfd;
+	ssize_t res = 0;
+	uint32_t crc = 0, expected;
+
+	snprintf(tmpname, sizeof(tmpname), "%s/.%s.tmp", dest_dir, name);
+	snprintf(dst, sizeof(dst), "%s/%s", dest_dir, name);
+
+	sfd = open(src, O_RDONLY);
+	if (sfd < 0) {
+		fprintf(stderr, "open(%s) failed: %s\n", src, strerror(errno));
+		return -1;
+	}
+	dfd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (dfd < 0) {
+		fprintf(stderr, "open(%s) failed: %s\n", tmpname, strerror(errno));
+		close(sfd);
+		return -1;
+	}
+
+	while ((res = read(sfd, buf, sizeof(buf))) > 0) {
+		if (write(dfd, buf, res) != res) {
+			res = -1;
+			break;
+		}
+		crc = crc32c(crc, buf, res);
+	}
+
+	/* Carry the checksum over. If the spool can't store one, this is the best we can do. */
+	if (!crc32c_get(sfd, src, &expected)) {
+		if (crc != expected) {
+			/* Keep the original checksum, so the damage can be found later */
+			fprintf(stderr, "Checksum mismatch for spooled capture %s (%08x != %08x)\n", src, crc, expected);
+			crc = expected;
+		}
+	} else if (errno == EINVAL) {
+		fprintf(stderr, "Spooled capture %s has a malformed checksum, replacing it\n", src);
+	}
+	close(sfd);
+	if (res >= 0 && crc32c_set(dfd, tmpname, crc) && !checksum_warned) {
+		fprintf(stderr, "Unable to store checksum for %s: %s\n", tmpname, strerror(errno));
+		checksum_warned = 1;
+	}
+
+	/* Make sure the data is on disk before the spooled copy goes away */
+	if (res < 0 || fsync(dfd)) {
+		fprintf(stderr, "Failed to copy %s to %s: %s\n", src, tmpname, strerror(errno));
+		close(dfd);
+		crc32c_unlink(tmpname);
+		return -1;
+	}
+	close(dfd);
+
+	if (crc32c_rename(tmpname, dst)) {
+		fprintf(stderr, "rename(%s, %s) failed: %s\n", tmpname, dst, strerror(errno));
+		crc32c_unlink(tmpname);
+		return -1;
+	}
+	return 0;
+}
+
+static void sync_dir(const char *dir)
+{
+	int fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		fprintf(stderr, "open(%s) failed: %s\n", dir, strerror(errno));
+		return;
+	}
+	if (fsync(fd)) {
+		fprintf(stderr, "fsync(%s) failed: %s\n", dir, strerror(errno));
+	}
+	close(fd);
+}
+
+/*!
+ * \brief Migrate everything currently in the spool
+ * \retval 0 if everything was migrated, -1 if something wasn't
+ */
+static int migrate_all(void)
+{
+	struct dirent **entries;
+	char src[1024], dst[1024];
+	int i, n, copied, migrated = 0, res = 0;
+	int copy_start = cross_device ? 0 : -1;
+
+	/* Names start with the timestamp, so sorting them migrates the oldest first */
+	n = scandir(spool_dir, &entries, spool_filter, alphasort);
+	if (n < 0) {
+		fprintf(stderr, "scandir(%s) failed: %s\n", spool_dir, strerror(errno));
+		return -1;
+	}
+
+	for (copied = 0; copied < n; copied++) {
+		const char *name = entries[copied]->d_name;
+		snprintf(src, sizeof(src), "%s/%s", spool_dir, name);
+		if (!cross_device) {
+			snprintf(dst, sizeof(dst), "%s/%s", dest_dir, name);
+			if (!crc32c_rename(src, dst)) {
+				migrated++;
+				continue;
+			} else if (errno != EXDEV) {
+				fprintf(stderr, "rename(%s, %s) failed: %s\n", src, dst, strerror(errno));
+				res = -1;
+				break;
+			}
+			cross_device = 1;
+			copy_start = copied;
+		}
+		if (copy_file(src, name)) {
+			/* Stop here, so that captures still arrive in order */
+			res = -1;
+			break;
+		}
+	}
+
+	/* Make the whole batch durable at once, then remove the spooled copies */
+	if (copied || migrated) {
+		sync_dir(dest_dir);
+	}
+	if (copy_start >= 0) {
+		for (i = copy_start; i < copied; i++) {
+			snprintf(src, sizeof(src), "%s/%s", spool_dir, entries[i]->d_name);
+			if (crc32c_unlink(src)) {
+				fprintf(stderr, "unlink(%s) failed: %s\n", src, strerror(errno));
+			} else {
+				migrated++;
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		free(entries[i]);
+	}
+	free(entries);
+
+	pthread_mutex_lock(&lock);
+	spooled -= migrated;
+	pthread_mutex_unlock(&lock);
+	return res;
+}
+
+static void *migrator(void *varg)
+{
+	int delay = 0;
+
+	(void) varg;
+
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		if (delay) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += delay;
+			while (!dirty) {
+				if (pthread_cond_timedwait(&cond, &lock, &ts) == ETIMEDOUT) {
+					break;
+				}
+			}
+		} else {
+			while (!dirty) {
+				pthread_cond_wait(&cond, &lock);
+			}
+		}
+		dirty = 0;
+		pthread_mutex_unlock(&lock);
+
+		if (migrate_all()) {
+			/* Back off while the output directory is unavailable */
+			delay = delay ? delay * 2 : 1;
+			if (delay > MAX_RETRY_DELAY) {
+				delay = MAX_RETRY_DELAY;
+			}
+			fprintf(stderr, "Failed to migrate spooled captures, retrying in %d s\n", delay);
+		} else {
+			delay = 0;
+		}
+	}
+	return NULL;
+}
+
+static int visible_filter(const struct dirent *entry)
+{
+	return entry->d_name[0] != '.' && !crc32c_is_sidecar(entry->d_name);
+}
+
+/*! \brief Count (and finish committing) whatever a previous run left in the spool */
+static int recover(void)
+{
+	struct dirent **entries;
+	char tmpname[1024], name[1024];
+	int i, n, count = 0;
+
+	/* Take a snapshot first, so renamed files aren't seen twice */
+	n = scandir(spool_dir, &entries, visible_filter, alphasort);
+	if (n < 0) {
+		fprintf(stderr, "scandir(%s) failed: %s\n", spool_dir, strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		const char *file = entries[i]->d_name;
+		if (is_tmp(file)) {
+			/* Captures are written all at once, so this is complete
+			 * unless we crashed in the middle of the write.
+			 * Either way, it's better to keep it. */
+			snprintf(tmpname, sizeof(tmpname), "%s/%s", spool_dir, file);
+			snprintf(name, sizeof(name), "%s/%.*s", spool_dir, (int) strlen(file) - 4, file);
+			fprintf(stderr, "Recovering uncommitted capture %s\n", tmpname);
+			if (crc32c_rename(tmpname, name)) {
+				fprintf(stderr, "rename(%s, %s) failed: %s\n", tmpname, name, strerror(errno));
+				continue;
+			}
+		}
+		count++;
+	}
+
+	for (i = 0; i < n; i++) {
+		free(entries[i]);
+	}
+	free(entries);
+	return count;
+}
+
+int spool_start(const char *spooldir, const char *destdir)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	int res;
+
+	strncpy(spool_dir, spooldir, sizeof(spool_dir) - 1);
+	spool_dir[sizeof(spool_dir) - 1] = '\0';
+	strncpy(dest_dir, destdir, sizeof(dest_dir) - 1);
+	dest_dir[sizeof(dest_dir) - 1] = '\0';
+
+	res = recover();
+	if (res < 0) {
+		return -1;
+	}
+	if (res) {
+		fprintf(stderr, "%d captures left in spool %s, migrating them first\n", res, spool_dir);
+	}
+	spooled = res;
+	dirty = res ? 1 : 0;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	res = pthread_create(&thread, &attr, migrator, NULL);
+	pthread_attr_destroy(&attr);
+	if (res) {
+		fprintf(stderr, "pthread_create failed: %s\n", strerror(res));
+		return -1;
+	}
+	return 0;
+}
+
+int spool_reserve(void)
+{
+	int res = -1;
+
+	pthread_mutex_lock(&lock);
+	if (spooled < SPOOL_MAX_FILES) {
+		spooled++;
+		res = 0;
+	}
+	pthread_mutex_unlock(&lock);
+	return res;
+}
+
+int spool_commit(const char *tmpname)
+{
+	char name[1024];
+	size_t len = strlen(tmpname);
+
+	if (len <= 4 || len - 4 >= sizeof(name)) {
+		return -1;
+	}
+	memcpy(name, tmpname, len - 4);
+	name[len - 4] = '\0';
+
+	if (crc32c_rename(tmpname, name)) {
+		fprintf(stderr, "rename(%s, %s) failed: %s\n", tmpname, name, strerror(errno));
+		return -1;
+	}
+
+	pthread_mutex_lock(&lock);
+	dirty = 1;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+void spool_release(void)
+{
+	pthread_mutex_lock(&lock);
+	spooled--;
+	pthread_mutex_unlock(&lock);
+}
+
+int spool_pending(void)
+{
+	int res;
+
+	pthread_mutex_lock(&lock);
+	res = spooled;
+	pthread_mutex_unlock(&lock);
+	return res;
+}
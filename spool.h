@@ -0,0 +1,54 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Spool for captures, migrated to the output directory in the background
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#ifndef _PROTEL_SPOOL_H
+#define _PROTEL_SPOOL_H
+
+/*! \brief Maximum number of captures that may be waiting in the spool */
+#define SPOOL_MAX_FILES 10000
+
+/*!
+ * \brief Start migrating captures from the spool directory to the output directory.
+ * Anything left over in the spool from a previous run is migrated first.
+ * \param spooldir Spool directory, ideally on tmpfs
+ * \param destdir Output directory
+ * \retval 0 on success, -1 on failure
+ */
+int spool_start(const char *spooldir, const char *destdir);
+
+/*!
+ * \brief Reserve room for a capture in the spool
+ * \retval 0 if there is room, -1 if the spool is full (and the capture should be saved directly)
+ */
+int spool_reserve(void);
+
+/*!
+ * \brief Commit a spooled capture for migration
+ * \param tmpname Full path of the completely written capture in the spool directory, which must end in ".tmp"
+ * \retval 0 on success, -1 on failure (in which case the caller should release the reservation)
+ */
+int spool_commit(const char *tmpname);
+
+/*! \brief Release a reservation that won't be committed */
+void spool_release(void);
+
+/*! \brief Number of captures currently in the spool */
+int spool_pending(void);
+
+#endif /* _PROTEL_SPOOL_H */
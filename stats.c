@@ -0,0 +1,282 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Fleet-level call statistics
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Tracks, at constant memory and O(1) cost per call:
+ * - Distinct numbers reached each day for the last STATS_DAYS days, overall and per peer (HyperLogLog)
+ * - The numbers and peers that fail most often (Count-Min + top-k)
+ * - The distribution of each numeric payload field (quantile sketch)
+ *
+ * The whole thing is one flat struct, so statistics from multiple nodes
+ * can be saved to files and merged later (see protelstats).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "protel.h"
+#include "stats.h"
+
+/* Peers and numbers share a Count-Min sketch, so keep them apart */
+#define PEER_KEY(addr) ((1ULL << 63) | (addr))
+
+static const int delimiters[DATA_STARS] = DATA_DELIMITERS;
+
+/* Which numeric fields are tracked, counting the phone number as the first.
+ * Field n is between delimiters n - 1 and n. */
+static const int field_num[STATS_FIELDS] = { 2, 4, 5, 6, 7 };
+
+#define field_start(i) (delimiters[field_num[i] - 1] + 1)
+#define field_end(i) (delimiters[field_num[i]])
+
+void stats_init(struct fleet_stats *s)
+{
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	s->magic = STATS_MAGIC;
+	s->version = STATS_VERSION;
+	for (i = 0; i < STATS_DAYS; i++) {
+		s->days[i].day = -1;
+	}
+}
+
+/*!
+ * \brief Get the distinct counts for a day, replacing the oldest day kept if needed
+ * \return NULL if the day is older than the days being kept
+ */
+static struct stats_day *get_day(struct fleet_stats *s, int64_t day)
+{
+	struct stats_day *d = &s->days[day % STATS_DAYS];
+
+	if (d->day != day) {
+		if (d->day > day) {
+			return NULL;
+		}
+		memset(d, 0, sizeof(*d));
+		d->day = day;
+	}
+	return d;
+}
+
+static struct hll *peer_hll(struct stats_day *d, uint32_t peer)
+{
+	int i;
+
+	for (i = 0; i < d->num_peers; i++) {
+		if (d->peers[i].addr == peer) {
+			return &d->peers[i].hll;
+		}
+	}
+	if (d->num_peers == STATS_MAX_PEERS) {
+		return NULL; /* Still counted in the overall total */
+	}
+	d->peers[d->num_peers].addr = peer;
+	return &d->peers[d->num_peers++].hll;
+}
+
+void stats_call(struct fleet_stats *s, time_t now, uint32_t peer, uint64_t number, const char *payload)
+{
+	struct stats_day *d = get_day(s, now / 86400);
+	int i;
+
+	s->calls++;
+	if (payload) {
+		s->successes++;
+		/* An unknown number isn't a distinct number */
+		if (d && number) {
+			struct hll *h = peer_hll(d, peer);
+			hll_add(&d->numbers, number);
+			if (h) {
+				hll_add(h, number);
+			}
+		}
+		for (i = 0; i < STATS_FIELDS; i++) {
+			const char *c = payload + field_start(i);
+			double value = 0;
+			for (; c < payload + field_end(i) && *c >= '0' && *c <= '9'; c++) {
+				value = value * 10 + (*c - '0');
+			}
+			if (c == payload + field_end(i)) { /* Only if the whole field is numeric */
+				quantiles_add(&s->fields[i], value);
+			}
+		}
+	} else {
+		if (number) {
+			topk_offer(&s->failing_numbers, number, cms_add(&s->failures, number));
+		}
+		topk_offer(&s->failing_peers, PEER_KEY(peer), cms_add(&s->failures, PEER_KEY(peer)));
+	}
+}
+
+void stats_merge(struct fleet_stats *s, const struct fleet_stats *other)
+{
+	int i, j;
+
+	/* Distinct counts are merged day by day, keeping the latest days */
+	for (i = 0; i < STATS_DAYS; i++) {
+		const struct stats_day *o = &other->days[i];
+		struct stats_day *d;
+		if (o->day < 0) {
+			continue;
+		}
+		d = get_day(s, o->day);
+		if (!d) {
+			continue;
+		}
+		hll_merge(&d->numbers, &o->numbers);
+		for (j = 0; j < o->num_peers; j++) {
+			struct hll *h = peer_hll(d, o->peers[j].addr);
+			if (h) {
+				hll_merge(h, &o->peers[j].hll);
+			}
+		}
+	}
+
+	s->calls += other->calls;
+	s->successes += other->successes;
+	cms_merge(&s->failures, &other->failures);
+	topk_merge(&s->failing_numbers, &other->failing_numbers, &s->failures);
+	topk_merge(&s->failing_peers, &other->failing_peers, &s->failures);
+	for (i = 0; i < STATS_FIELDS; i++) {
+		quantiles_merge(&s->fields[i], &other->fields[i]);
+	}
+}
+
+void stats_print(FILE *fp, struct fleet_stats *s)
+{
+	char addr[INET_ADDRSTRLEN];
+	char date[32];
+	struct tm tm;
+	struct in_addr in;
+	int64_t latest = -1, day;
+	int i, j;
+
+	fprintf(fp, "%-16s: %5lu\n", "Total Calls", (unsigned long) s->calls);
+	fprintf(fp, "%-16s: %5lu\n", "Total Succeeded", (unsigned long) s->successes);
+
+	/* Most recent day first */
+	for (i = 0; i < STATS_DAYS; i++) {
+		if (s->days[i].day > latest) {
+			latest = s->days[i].day;
+		}
+	}
+	for (day = latest; day >= 0 && day > latest - STATS_DAYS; day--) {
+		const struct stats_day *d = &s->days[day % STATS_DAYS];
+		time_t t = (time_t) day * 86400;
+		if (d->day != day) {
+			continue;
+		}
+		gmtime_r(&t, &tm);
+		strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+		fprintf(fp, "Distinct numbers reached on %s: %.0f\n", date, hll_estimate(&d->numbers));
+		for (j = 0; j < d->num_peers; j++) {
+			in.s_addr = d->peers[j].addr;
+			inet_ntop(AF_INET, &in, addr, sizeof(addr));
+			fprintf(fp, "   %-16s: %.0f\n", addr, hll_estimate(&d->peers[j].hll));
+		}
+	}
+
+	topk_sort(&s->failing_numbers);
+	if (s->failing_numbers.num_items) {
+		fprintf(fp, "Most failing numbers:\n");
+	}
+	for (i = 0; i < s->failing_numbers.num_items; i++) {
+		fprintf(fp, "   %010lu      : ~%u\n", (unsigned long) s->failing_numbers.items[i], s->failing_numbers.counts[i]);
+	}
+
+	topk_sort(&s->failing_peers);
+	if (s->failing_peers.num_items) {
+		fprintf(fp, "Most failing peers:\n");
+	}
+	for (i = 0; i < s->failing_peers.num_items; i++) {
+		in.s_addr = (uint32_t) s->failing_peers.items[i];
+		inet_ntop(AF_INET, &in, addr, sizeof(addr));
+		fprintf(fp, "   %-16s: ~%u\n", addr, s->failing_peers.counts[i]);
+	}
+
+	for (i = 0; i < STATS_FIELDS; i++) {
+		const struct quantiles *q = &s->fields[i];
+		if (!q->count) {
+			continue;
+		}
+		fprintf(fp, "Field %d: p50 %.0f, p90 %.0f, p99 %.0f, max %.0f (%lu samples)\n", field_num[i],
+			quantiles_estimate(q, 0.5), quantiles_estimate(q, 0.9), quantiles_estimate(q, 0.99), quantiles_estimate(q, 1), (unsigned long) q->count);
+	}
+}
+
+int stats_save(const char *filename, const struct fleet_stats *s)
+{
+	char tmpname[1024];
+	FILE *fp;
+
+	/* Write a new file and rename it, so there's always a complete copy */
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+	fp = fopen(tmpname, "wb");
+	if (!fp) {
+		fprintf(stderr, "fopen(%s) failed: %s\n", tmpname, strerror(errno));
+		return -1;
+	}
+	if (fwrite(s, sizeof(*s), 1, fp) != 1) {
+		fprintf(stderr, "Failed to write %s: %s\n", tmpname, strerror(errno));
+		fclose(fp);
+		return -1;
+	}
+	if (fclose(fp)) {
+		fprintf(stderr, "Failed to write %s: %s\n", tmpname, strerror(errno));
+		return -1;
+	}
+	if (rename(tmpname, filename)) {
+		fprintf(stderr, "rename(%s, %s) failed: %s\n", tmpname, filename, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int stats_load(const char *filename, struct fleet_stats *s)
+{
+	FILE *fp;
+	size_t res;
+	int i;
+
+	fp = fopen(filename, "rb");
+	if (!fp) {
+		fprintf(stderr, "fopen(%s) failed: %s\n", filename, strerror(errno));
+		return -1;
+	}
+	res = fread(s, sizeof(*s), 1, fp);
+	fclose(fp);
+	if (res != 1 || s->magic != STATS_MAGIC || s->version != STATS_VERSION) {
+		fprintf(stderr, "%s is not a statistics file (or is from a different version)\n", filename);
+		return -1;
+	}
+	for (i = 0; i < STATS_DAYS; i++) {
+		if (s->days[i].num_peers < 0 || s->days[i].num_peers > STATS_MAX_PEERS
+			|| s->days[i].day < -1 || (s->days[i].day >= 0 && s->days[i].day % STATS_DAYS != i)) {
+			fprintf(stderr, "%s is corrupted\n", filename);
+			return -1;
+		}
+	}
+	if (s->failing_numbers.num_items < 0 || s->failing_numbers.num_items > TOPK_SIZE
+		|| s->failing_peers.num_items < 0 || s->failing_peers.num_items > TOPK_SIZE) {
+		fprintf(stderr, "%s is corrupted\n", filename);
+		return -1;
+	}
+	return 0;
+}
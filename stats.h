@@ -0,0 +1,90 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Fleet-level call statistics
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#ifndef _PROTEL_STATS_H
+#define _PROTEL_STATS_H
+
+#include <stdio.h>
+#include <time.h>
+
+#include "sketch.h"
+
+#define STATS_MAGIC 0x50524F54 /* "PROT" */
+#define STATS_VERSION 2
+
+#define STATS_MAX_PEERS 16
+
+/*! \brief Number of days distinct counts are kept for */
+#define STATS_DAYS 7
+
+/*! \brief Number of numeric payload fields (after the phone number) that are tracked */
+#define STATS_FIELDS 5
+
+struct peer_hll {
+	uint32_t addr;
+	uint32_t unused;
+	struct hll hll;
+};
+
+/*! \brief Distinct numbers reached on one day */
+struct stats_day {
+	int64_t day;			/*!< Day (since the epoch, UTC), or -1 if unused */
+	struct hll numbers;		/*!< Distinct numbers reached */
+	struct peer_hll peers[STATS_MAX_PEERS]; /*!< Distinct numbers reached, per peer */
+	int32_t num_peers;
+	int32_t unused;
+};
+
+/*! \brief Statistics, in a fixed-size struct that can be saved and merged as is */
+struct fleet_stats {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t calls;
+	uint64_t successes;
+	struct stats_day days[STATS_DAYS]; /*!< Indexed by day % STATS_DAYS */
+	struct cms failures;	/*!< Failed calls, by number and by peer */
+	struct topk failing_numbers;
+	struct topk failing_peers;
+	struct quantiles fields[STATS_FIELDS];
+};
+
+void stats_init(struct fleet_stats *s);
+
+/*!
+ * \brief Account for a call
+ * \param s
+ * \param now
+ * \param peer Peer address, in network byte order
+ * \param number Phone number, or 0 if unknown
+ * \param payload Payload, starting at the first '*', if successful
+ */
+void stats_call(struct fleet_stats *s, time_t now, uint32_t peer, uint64_t number, const char *payload);
+
+/*! \brief Merge statistics from another node or shard */
+void stats_merge(struct fleet_stats *s, const struct fleet_stats *other);
+
+void stats_print(FILE *fp, struct fleet_stats *s);
+
+/*! \retval 0 on success, -1 on failure */
+int stats_save(const char *filename, const struct fleet_stats *s);
+
+/*! \retval 0 on success, -1 on failure */
+int stats_load(const char *filename, struct fleet_stats *s);
+
+#endif /* _PROTEL_STATS_H */
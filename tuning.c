@@ -0,0 +1,200 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Per-peer tuning of when to give up on a call
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Carriers differ: some deliver clean data slowly, others garbage quickly.
+ * Rather than one fixed set of thresholds, we track how calls from each
+ * peer (the Asterisk server connecting to us) actually go, and adjust:
+ *
+ * - The abort deadline follows the time it takes to get a payload,
+ *   (mean + 3 standard deviations, plus some slack), so we stop paying
+ *   for calls that have run well past the point they'd normally succeed.
+ *   The slack shrinks as failed calls waste more of the deadline,
+ *   since that's what each extra second costs.
+ *
+ * - Waiting for the second printout after a corrupted one only pays off
+ *   if it's usually good. If it rarely is, give up on the first corruption.
+ *
+ * Every so often, a call is made with the most permissive settings,
+ * so that we keep observing slow successes and recoveries
+ * even after the parameters have been tightened.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "tuning.h"
+
+#define ALPHA 0.1 /* Weight of each new sample in the moving averages */
+#define MIN_SAMPLES 10 /* Samples needed before we adjust anything */
+#define ADJUST_INTERVAL 10 /* Calls between adjustments */
+#define EXPLORE_INTERVAL 10 /* One in this many calls uses the most permissive settings */
+#define RECOVERY_THRESHOLD 0.1 /* Minimum rate of recovery from a corrupted printout worth waiting for */
+#define MIN_SLACK 1 /* Seconds past the expected latency to wait, when failures waste the whole deadline */
+#define MAX_SLACK 5 /* ...and when they waste none of it */
+
+struct peer {
+	struct peer *next;
+	struct in_addr addr;
+	unsigned int started;		/* Calls started */
+	unsigned int calls;			/* Calls finished */
+	unsigned int successes;
+	unsigned int second_chances; /* Calls that got a corrupted printout, and waited for the next one */
+	double recovery_rate;		/* How many of those got a good one */
+	double latency_mean;		/* Seconds to receive a payload */
+	double latency_var;
+	double success_rate;
+	double wasted;				/* Seconds spent on failed calls */
+	struct call_params params;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct peer *peers = NULL;
+static int enabled = 0;
+
+void tuning_enable(void)
+{
+	enabled = 1;
+}
+
+/*! \note Must be called with the lock held */
+static struct peer *find_peer(struct in_addr addr)
+{
+	struct peer *p;
+
+	for (p = peers; p; p = p->next) {
+		if (p->addr.s_addr == addr.s_addr) {
+			return p;
+		}
+	}
+
+	p = calloc(1, sizeof(*p));
+	if (!p) {
+		return NULL;
+	}
+	p->addr = addr;
+	p->params.deadline = MAX_DEADLINE;
+	p->params.max_corrupt = MAX_CORRUPT;
+	p->next = peers;
+	peers = p;
+	return p;
+}
+
+void tuning_get(struct in_addr addr, struct call_params *params)
+{
+	struct peer *p;
+
+	/* Defaults, same as if there were no tuning */
+	params->deadline = 0;
+	params->max_corrupt = MAX_CORRUPT;
+
+	if (!enabled) {
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	p = find_peer(addr);
+	if (p) {
+		if (++p->started % EXPLORE_INTERVAL) {
+			*params = p->params;
+		} else {
+			params->deadline = MAX_DEADLINE;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/*! \note Must be called with the lock held */
+static void adjust(struct peer *p)
+{
+	char addr[INET_ADDRSTRLEN];
+	struct call_params old = p->params;
+
+	if (p->successes >= MIN_SAMPLES) {
+		/* The more of the deadline failed calls waste, the less benefit of the doubt
+		 * (e.g. carriers that usually deliver garbage, then never hang up) */
+		double wasted = p->wasted / p->params.deadline;
+		double slack = MIN_SLACK + (MAX_SLACK - MIN_SLACK) * (1 - (1 - p->success_rate) * (wasted < 1 ? wasted : 1));
+		int deadline = (int) ceil(p->latency_mean + 3 * sqrt(p->latency_var) + slack);
+		if (deadline < MIN_DEADLINE) {
+			deadline = MIN_DEADLINE;
+		} else if (deadline > MAX_DEADLINE) {
+			deadline = MAX_DEADLINE;
+		}
+		p->params.deadline = deadline;
+	}
+
+	if (p->second_chances >= MIN_SAMPLES) {
+		/* Require twice the threshold to go back, so that we don't flap around it */
+		if (p->recovery_rate < RECOVERY_THRESHOLD) {
+			p->params.max_corrupt = MIN_CORRUPT;
+		} else if (p->recovery_rate >= 2 * RECOVERY_THRESHOLD) {
+			p->params.max_corrupt = MAX_CORRUPT;
+		}
+	}
+
+	if (memcmp(&old, &p->params, sizeof(old))) {
+		inet_ntop(AF_INET, &p->addr, addr, sizeof(addr));
+		fprintf(stderr, "Peer %s: deadline %d -> %d s, max corrupt printouts %d -> %d (latency %.1f +/- %.1f s, success %.0f%%, %.1f s wasted per failure, %.0f%% recovered)\n",
+			addr, old.deadline, p->params.deadline, old.max_corrupt, p->params.max_corrupt,
+			p->latency_mean, sqrt(p->latency_var), 100 * p->success_rate, p->wasted, 100 * p->recovery_rate);
+	}
+}
+
+void tuning_report(struct in_addr addr, const struct call_params *params, int success, double seconds, int corrupt)
+{
+	struct peer *p;
+
+	if (!enabled) {
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	p = find_peer(addr);
+	if (!p) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	p->success_rate = p->calls++ ? (1 - ALPHA) * p->success_rate + ALPHA * success : success;
+	if (success) {
+		if (!p->successes++) {
+			p->latency_mean = seconds;
+		} else {
+			/* Exponentially weighted mean and variance */
+			double diff = seconds - p->latency_mean;
+			p->latency_mean += ALPHA * diff;
+			p->latency_var = (1 - ALPHA) * (p->latency_var + ALPHA * diff * diff);
+		}
+	} else {
+		p->wasted = p->wasted ? (1 - ALPHA) * p->wasted + ALPHA * seconds : seconds;
+	}
+	if (corrupt && params->max_corrupt > 1) {
+		/* A moving average like the rest, so that a carrier that improves
+		 * gets its second chances back, even if only exploring calls sample it */
+		p->recovery_rate = p->second_chances++ ? (1 - ALPHA) * p->recovery_rate + ALPHA * success : success;
+	}
+
+	if (!(p->calls % ADJUST_INTERVAL)) {
+		adjust(p);
+	}
+	pthread_mutex_unlock(&lock);
+}
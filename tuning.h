@@ -0,0 +1,60 @@
+/*
+ * Outbound Protel dialer daemon for use with Asterisk softmodem
+ *
+ * Copyright (C) 2024, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Per-peer tuning of when to give up on a call
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#ifndef _PROTEL_TUNING_H
+#define _PROTEL_TUNING_H
+
+#include <netinet/in.h>
+
+/* Safe bounds for the abort deadline, in seconds.
+ * The upper bound matches the TIMEOUT(absolute) in the sample dialplan. */
+#define MIN_DEADLINE 20
+#define MAX_DEADLINE 90
+
+/* Bounds for the number of corrupted printouts before giving up.
+ * The modem only sends the printout twice. */
+#define MIN_CORRUPT 1
+#define MAX_CORRUPT 2
+
+struct call_params {
+	int deadline;		/*!< Seconds after connecting to give up, 0 for never */
+	int max_corrupt;	/*!< Corrupted printouts to receive before giving up */
+};
+
+/*! \brief Enable auto-tuning. If not enabled, calls always get the defaults. */
+void tuning_enable(void);
+
+/*!
+ * \brief Get the parameters to use for a call from a peer
+ * \param addr Address of the peer (the Asterisk server running Softmodem)
+ * \param[out] params
+ */
+void tuning_get(struct in_addr addr, struct call_params *params);
+
+/*!
+ * \brief Report how a call went
+ * \param addr Address of the peer
+ * \param params Parameters the call used
+ * \param success Whether a payload was received
+ * \param seconds How long the call was connected
+ * \param corrupt Number of corrupted printouts received
+ */
+void tuning_report(struct in_addr addr, const struct call_params *params, int success, double seconds, int corrupt);
+
+#endif /* _PROTEL_TUNING_H */